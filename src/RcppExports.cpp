@@ -32,10 +32,118 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// simulateTumorBatchcpp
+Rcpp::List simulateTumorBatchcpp(Rcpp::List input);
+RcppExport SEXP _SITH_simulateTumorBatchcpp(SEXP inputSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::List >::type input(inputSEXP);
+    rcpp_result_gen = Rcpp::wrap(simulateTumorBatchcpp(input));
+    return rcpp_result_gen;
+END_RCPP
+}
+// simulateSummariescpp
+Rcpp::NumericMatrix simulateSummariescpp(Rcpp::List input);
+RcppExport SEXP _SITH_simulateSummariescpp(SEXP inputSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::List >::type input(inputSEXP);
+    rcpp_result_gen = Rcpp::wrap(simulateSummariescpp(input));
+    return rcpp_result_gen;
+END_RCPP
+}
+// resumeTumorcpp
+Rcpp::List resumeTumorcpp(Rcpp::List input);
+RcppExport SEXP _SITH_resumeTumorcpp(SEXP inputSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::List >::type input(inputSEXP);
+    rcpp_result_gen = Rcpp::wrap(resumeTumorcpp(input));
+    return rcpp_result_gen;
+END_RCPP
+}
+// bulkSamplescpp
+Rcpp::List bulkSamplescpp(Rcpp::List input);
+RcppExport SEXP _SITH_bulkSamplescpp(SEXP inputSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::List >::type input(inputSEXP);
+    rcpp_result_gen = Rcpp::wrap(bulkSamplescpp(input));
+    return rcpp_result_gen;
+END_RCPP
+}
+// singleCellscpp
+Rcpp::List singleCellscpp(Rcpp::List input);
+RcppExport SEXP _SITH_singleCellscpp(SEXP inputSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::List >::type input(inputSEXP);
+    rcpp_result_gen = Rcpp::wrap(singleCellscpp(input));
+    return rcpp_result_gen;
+END_RCPP
+}
+// jaccardcpp
+Rcpp::List jaccardcpp(Rcpp::List input);
+RcppExport SEXP _SITH_jaccardcpp(SEXP inputSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::List >::type input(inputSEXP);
+    rcpp_result_gen = Rcpp::wrap(jaccardcpp(input));
+    return rcpp_result_gen;
+END_RCPP
+}
+// radialProfilecpp
+Rcpp::List radialProfilecpp(Rcpp::List input);
+RcppExport SEXP _SITH_radialProfilecpp(SEXP inputSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::List >::type input(inputSEXP);
+    rcpp_result_gen = Rcpp::wrap(radialProfilecpp(input));
+    return rcpp_result_gen;
+END_RCPP
+}
+// renderPointscpp
+Rcpp::List renderPointscpp(Rcpp::List input);
+RcppExport SEXP _SITH_renderPointscpp(SEXP inputSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::List >::type input(inputSEXP);
+    rcpp_result_gen = Rcpp::wrap(renderPointscpp(input));
+    return rcpp_result_gen;
+END_RCPP
+}
+// slicescpp
+Rcpp::List slicescpp(Rcpp::List input);
+RcppExport SEXP _SITH_slicescpp(SEXP inputSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::List >::type input(inputSEXP);
+    rcpp_result_gen = Rcpp::wrap(slicescpp(input));
+    return rcpp_result_gen;
+END_RCPP
+}
 
 static const R_CallMethodDef CallEntries[] = {
     {"_SITH_simulateTumorcpp", (DL_FUNC) &_SITH_simulateTumorcpp, 1},
     {"_SITH_simulateTumorUDTcpp", (DL_FUNC) &_SITH_simulateTumorUDTcpp, 1},
+    {"_SITH_simulateTumorBatchcpp", (DL_FUNC) &_SITH_simulateTumorBatchcpp, 1},
+    {"_SITH_simulateSummariescpp", (DL_FUNC) &_SITH_simulateSummariescpp, 1},
+    {"_SITH_resumeTumorcpp", (DL_FUNC) &_SITH_resumeTumorcpp, 1},
+    {"_SITH_bulkSamplescpp", (DL_FUNC) &_SITH_bulkSamplescpp, 1},
+    {"_SITH_singleCellscpp", (DL_FUNC) &_SITH_singleCellscpp, 1},
+    {"_SITH_jaccardcpp", (DL_FUNC) &_SITH_jaccardcpp, 1},
+    {"_SITH_radialProfilecpp", (DL_FUNC) &_SITH_radialProfilecpp, 1},
+    {"_SITH_renderPointscpp", (DL_FUNC) &_SITH_renderPointscpp, 1},
+    {"_SITH_slicescpp", (DL_FUNC) &_SITH_slicescpp, 1},
     {NULL, NULL, 0}
 };
 
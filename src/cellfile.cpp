@@ -0,0 +1,77 @@
+#include"cellfile.h"
+#include"fileformat.h"
+#include<cstdio>
+#include<cstring>
+#include<stdexcept>
+
+struct CellFileHeader {
+    char magic[8];
+    uint32_t version;
+    //BYTE_ORDER_MARK
+    uint32_t byte_order;
+    uint32_t chunk_rows, nchunks;
+    double ncells;
+    uint32_t nspecies, unused;
+};
+
+static const char MAGIC[8] = {'S','I','T','H','C','E','L','L'};
+
+//bytes taken by a chunk of n cells
+static size_t chunk_bytes(const size_t n) {
+    const size_t bytes = 10*n + (n + 7)/8;
+    return bytes + (8 - bytes % 8) % 8;
+}
+
+void CellFile::write(const std::vector<cell> &cells, const std::vector<specie> &species, const std::string &path) {
+    //write next to the old file and replace it once the new one is complete
+    const std::string tmp = temporary_path(path);
+    FILE* f = fopen(tmp.c_str(), "wb");
+    if(f == NULL) {
+        throw std::runtime_error("Could not open " + path + " to write the cells.");
+    }
+    bool failed = false;
+
+    CellFileHeader header;
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = CELLFILE_VERSION;
+    header.byte_order = BYTE_ORDER_MARK;
+    header.chunk_rows = CELLFILE_CHUNK;
+    header.nchunks = (cells.size() + CELLFILE_CHUNK - 1)/CELLFILE_CHUNK;
+    header.ncells = cells.size();
+    header.nspecies = species.size();
+    header.unused = 0;
+    failed = fwrite(&header, sizeof(header), 1, f) != 1;
+
+    //each chunk is filled column by column in one buffer, then written at once
+    std::vector<char> buffer(chunk_bytes(CELLFILE_CHUNK));
+    for(size_t first = 0; first < cells.size() && !failed; first += CELLFILE_CHUNK) {
+        const size_t n = std::min((size_t)CELLFILE_CHUNK, cells.size() - first);
+        const size_t bytes = chunk_bytes(n);
+        memset(&buffer[0], 0, bytes);
+        int16_t* x = (int16_t*)&buffer[0];
+        int16_t* y = x + n;
+        int16_t* z = y + n;
+        char* ids = (char*)(z + n);
+        unsigned char* resistant = (unsigned char*)(ids + 4*n);
+        for(size_t i = 0; i < n; ++i) {
+            const cell &c = cells[first + i];
+            x[i] = c.x; y[i] = c.y; z[i] = c.z;
+            const int32_t id = c.id;
+            memcpy(ids + 4*i, &id, 4);
+            if(species[c.id].treatment_resistance) {resistant[i/8] |= 1 << (i % 8);}
+        }
+        failed = fwrite(&buffer[0], 1, bytes, f) != bytes;
+    }
+
+    std::vector<int32_t> nmuts(species.size());
+    for(size_t i = 0; i < species.size(); ++i) {nmuts[i] = species[i].nmuts;}
+    if(!failed && !nmuts.empty()) {
+        failed = fwrite(&nmuts[0], sizeof(int32_t), nmuts.size(), f) != nmuts.size();
+    }
+
+    if(fclose(f) != 0) {failed = true;}
+    if(failed) {remove(tmp.c_str());}
+    if(failed || !replace_file(tmp, path)) {
+        throw std::runtime_error("Could not write the cells to " + path + ".");
+    }
+}
@@ -0,0 +1,37 @@
+/*
+SITH: An R package for visualizing and analyzing a spatial model of intra-tumor heterogeneity
+Author: Phillip Nicol
+License: GPL-2
+*/
+
+/***********************************************************
+A cell file holds the cells of a simulated tumor on disk, so a very large tumor never has to be
+copied into an R matrix. The cells are written straight from the engine, one chunk at a time, and
+read back in R with readCells(), which only reads the chunks and columns it is asked for. An existing
+file is only replaced once the new one is complete (see fileformat.h).
+Layout (in the byte order of the machine that wrote it):
+    header: "SITHCELL", version, 0x01020304, rows per chunk, number of chunks,
+            number of cells (double), number of alleles, unused (40 bytes)
+    chunks: for the n cells of the chunk, x, y, z (int16[n] each), allele (int32[n]) and
+            the resistant flags (one bit per cell, lowest bit first), padded to 8 bytes
+    nmuts:  number of mutations of each allele (int32[number of alleles])
+Every chunk but the last holds CELLFILE_CHUNK cells, so any row is found without an index.
+The distance from the origin and the number of mutations of a cell are not stored, since they
+follow from its position and allele.
+*******************************************************/
+
+#ifndef CELLFILE_H_INCLUDED
+#define CELLFILE_H_INCLUDED
+
+#include<string>
+#include"simutils.h"
+
+#define CELLFILE_VERSION 1
+//cells per chunk, a multiple of 64 so that every full chunk ends on an 8 byte boundary
+#define CELLFILE_CHUNK 65536
+
+namespace CellFile {
+    void write(const std::vector<cell> &cells, const std::vector<specie> &species, const std::string &path);
+}
+
+#endif
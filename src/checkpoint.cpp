@@ -0,0 +1,410 @@
+#include"checkpoint.h"
+#include"fileformat.h"
+#include<cstdio>
+#include<stdexcept>
+#ifdef _WIN32
+#include<cstdlib>
+#else
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#endif
+
+//**** Layout of a snapshot ****//
+
+enum SectionTag {
+    SECTION_STATE = 1,
+    SECTION_CELLS,
+    SECTION_SPECIES,
+    SECTION_GENOTYPES,
+    SECTION_PHYLO_PARENTS,
+    SECTION_PHYLO_CHILDREN,
+    SECTION_DRIVERS,
+    SECTION_EDGE_COUNTS,
+    SECTION_EDGES,
+    SECTION_SAMPLER,
+    SECTION_LATTICE_SLOTS,
+    SECTION_LATTICE_CHUNKS,
+    SECTION_THERAPY,
+    SECTION_RESISTANT_STATES,
+    SECTION_DOSES,
+    SECTION_COUNT
+};
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    //BYTE_ORDER_MARK
+    uint32_t byte_order;
+    //sizes of the structs that are stored as they are
+    uint32_t cell_size, chunk_size, sampler_size, state_size;
+};
+
+struct SectionHeader {
+    uint32_t tag;
+    uint32_t unused;
+    uint64_t bytes;
+};
+
+struct SnapshotState {
+    //parameters the simulation was started with
+    double tumor_size, wt_br, wt_dr, u, du, s;
+    double recurrent_size, tr;
+    //state of the run
+    double time, total_death_rate, d_max;
+    double b_max, window_draws, window_events, window_size;
+    int32_t total_mutations, phase, udt, uniform;
+    int32_t lattice_lo[3], lattice_n[3];
+    Xoshiro256 rng;
+};
+
+//fixed size part of a species, its genotype is stored in SECTION_GENOTYPES
+struct SnapshotSpecie {
+    int32_t id, count, parent, nmuts;
+    double b, d;
+    double red, green, blue;
+    int32_t treatment_resistance, ngenotype;
+};
+
+static const char MAGIC[8] = {'S','I','T','H','S','N','A','P'};
+
+static SnapshotHeader make_header() {
+    SnapshotHeader header;
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = SNAPSHOT_VERSION;
+    header.byte_order = BYTE_ORDER_MARK;
+    header.cell_size = sizeof(cell);
+    header.chunk_size = sizeof(Chunk);
+    header.sampler_size = sizeof(RateSampler::Sums);
+    header.state_size = sizeof(SnapshotState);
+    return header;
+}
+
+//**** Writing ****//
+
+class SnapshotWriter {
+public:
+    SnapshotWriter(const std::string &path) : path(path), f(fopen(path.c_str(), "wb")), failed(f == NULL) {}
+    ~SnapshotWriter() {if(f != NULL) {fclose(f);}}
+
+    void put(const void* data, const size_t bytes) {
+        if(!failed && bytes > 0 && fwrite(data, 1, bytes, f) != bytes) {failed = true;}
+    }
+
+    //a section is a header, the data and padding up to a multiple of 8 bytes
+    void begin(const int tag, const size_t bytes) {
+        SectionHeader header = {(uint32_t)tag, 0, (uint64_t)bytes};
+        put(&header, sizeof(header));
+        pending = bytes;
+    }
+
+    void end() {
+        static const char zeros[8] = {0,0,0,0,0,0,0,0};
+        put(zeros, (8 - pending % 8) % 8);
+    }
+
+    void section(const int tag, const void* data, const size_t bytes) {
+        begin(tag, bytes);
+        put(data, bytes);
+        end();
+    }
+
+    void close() {
+        if(f != NULL && fclose(f) != 0) {failed = true;}
+        f = NULL;
+        if(failed) {
+            remove(path.c_str());
+            throw std::runtime_error("Could not write the checkpoint to " + path + ".");
+        }
+    }
+
+private:
+    std::string path;
+    FILE* f;
+    bool failed;
+    size_t pending;
+};
+
+void Checkpoint::write(const SimContext &ctx, const SimParams &p, const std::string &path) {
+    if(!ctx.rng.is_native()) {
+        throw std::runtime_error("Only simulations with a seed can be checkpointed.");
+    }
+    const bool udt = !ctx.G.empty();
+
+    SnapshotState state;
+    state.tumor_size = p.tumor_size;
+    state.wt_br = p.wt_br; state.wt_dr = p.wt_dr;
+    state.u = p.u; state.du = p.du; state.s = p.s;
+    state.recurrent_size = p.recurrent_size; state.tr = p.tr;
+    state.time = ctx.time;
+    state.total_death_rate = ctx.total_death_rate;
+    state.d_max = ctx.d_max;
+    state.b_max = ctx.b_max;
+    state.window_draws = ctx.window_draws;
+    state.window_events = ctx.window_events;
+    state.window_size = ctx.window_size;
+    state.total_mutations = ctx.total_mutations;
+    state.phase = ctx.phase;
+    state.udt = udt;
+    state.uniform = ctx.uniform;
+    ctx.lattice.extent(state.lattice_lo, state.lattice_n);
+    state.rng = ctx.rng.generator();
+
+    //write next to the old snapshot and replace it once the new one is complete
+    const std::string tmp = temporary_path(path);
+    SnapshotWriter out(tmp);
+    SnapshotHeader header = make_header();
+    out.put(&header, sizeof(header));
+    out.section(SECTION_STATE, &state, sizeof(state));
+    out.section(SECTION_CELLS, ctx.cells.data(), ctx.cells.size()*sizeof(cell));
+
+    const std::vector<specie> &species = ctx.species;
+    size_t ngenotype = 0;
+    out.begin(SECTION_SPECIES, species.size()*sizeof(SnapshotSpecie));
+    for(size_t i = 0; i < species.size(); ++i) {
+        const specie &sp = species[i];
+        SnapshotSpecie rec = {sp.id, sp.count, sp.parent, sp.nmuts, sp.b, sp.d, sp.red, sp.green, sp.blue,
+                              sp.treatment_resistance, (int32_t)sp.genotype.size()};
+        out.put(&rec, sizeof(rec));
+        ngenotype += sp.genotype.size();
+    }
+    out.end();
+    out.begin(SECTION_GENOTYPES, ngenotype*sizeof(int));
+    for(size_t i = 0; i < species.size(); ++i) {
+        out.put(species[i].genotype.data(), species[i].genotype.size()*sizeof(int));
+    }
+    out.end();
+
+    out.section(SECTION_PHYLO_PARENTS, ctx.phylo_tree[0].data(), ctx.phylo_tree[0].size()*sizeof(int));
+    out.section(SECTION_PHYLO_CHILDREN, ctx.phylo_tree[1].data(), ctx.phylo_tree[1].size()*sizeof(int));
+    out.section(SECTION_DRIVERS, ctx.drivers.data(), ctx.drivers.size()*sizeof(int));
+    out.section(SECTION_THERAPY, p.therapy.data(), p.therapy.size()*sizeof(Dose));
+    out.section(SECTION_RESISTANT_STATES, p.resistant_states.data(), p.resistant_states.size()*sizeof(int));
+    out.section(SECTION_DOSES, ctx.doses.data(), ctx.doses.size()*sizeof(DoseRecord));
+
+    if(udt) {
+        std::vector<int> counts(ctx.G.size());
+        size_t nedges = 0;
+        for(size_t i = 0; i < ctx.G.size(); ++i) {
+            counts[i] = ctx.G[i].size();
+            nedges += ctx.G[i].size();
+        }
+        out.section(SECTION_EDGE_COUNTS, counts.data(), counts.size()*sizeof(int));
+        out.begin(SECTION_EDGES, nedges*sizeof(Edge));
+        for(size_t i = 0; i < ctx.G.size(); ++i) {
+            out.put(ctx.G[i].data(), ctx.G[i].size()*sizeof(Edge));
+        }
+        out.end();
+    }
+
+    RateSampler::Sums sums = ctx.birth_sampler.sums();
+    out.section(SECTION_SAMPLER, &sums, sizeof(sums));
+
+    //the allocated chunks of the lattice and their slots in the directory
+    std::vector<uint64_t> slots;
+    slots.reserve(ctx.lattice.chunks());
+    for(size_t i = 0; i < ctx.lattice.slots(); ++i) {
+        if(ctx.lattice.chunk(i) != NULL) {slots.push_back(i);}
+    }
+    out.section(SECTION_LATTICE_SLOTS, slots.data(), slots.size()*sizeof(uint64_t));
+    out.begin(SECTION_LATTICE_CHUNKS, slots.size()*sizeof(Chunk));
+    for(size_t i = 0; i < slots.size(); ++i) {
+        out.put(ctx.lattice.chunk(slots[i]), sizeof(Chunk));
+    }
+    out.end();
+    out.close();
+
+    if(!replace_file(tmp, path)) {
+        throw std::runtime_error("Could not write the checkpoint to " + path + ".");
+    }
+}
+
+//**** Reading ****//
+
+//A read-only view of a whole file, memory mapped where the system allows it
+class MappedFile {
+public:
+    MappedFile(const std::string &path) : data(NULL), size(0) {
+#ifdef _WIN32
+        buffer = NULL;
+        FILE* f = fopen(path.c_str(), "rb");
+        if(f == NULL) {return;}
+        fseek(f, 0, SEEK_END);
+        const long n = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        if(n > 0 && (buffer = (char*) malloc(n)) != NULL && fread(buffer, 1, n, f) == (size_t)n) {
+            data = buffer;
+            size = n;
+        }
+        fclose(f);
+#else
+        const int fd = open(path.c_str(), O_RDONLY);
+        if(fd < 0) {return;}
+        struct stat st;
+        if(fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(map != MAP_FAILED) {
+                data = (const char*) map;
+                size = st.st_size;
+                madvise(map, size, MADV_SEQUENTIAL);
+            }
+        }
+        ::close(fd);
+#endif
+    }
+
+    ~MappedFile() {
+#ifdef _WIN32
+        free(buffer);
+#else
+        if(data != NULL) {munmap((void*) data, size);}
+#endif
+    }
+
+    const char* data;
+    size_t size;
+
+private:
+#ifdef _WIN32
+    char* buffer;
+#endif
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+};
+
+struct Section {
+    const char* data;
+    size_t bytes;
+};
+
+//copy a section into a vector of T
+template<class T>
+static void read_array(const Section &section, std::vector<T> &out) {
+    if(section.bytes % sizeof(T) != 0) {Rcpp::stop("The snapshot is corrupted.");}
+    out.resize(section.bytes/sizeof(T));
+    if(section.bytes > 0) {memcpy(out.data(), section.data, section.bytes);}
+}
+
+SimParams Checkpoint::read(SimContext &ctx, const std::string &path) {
+    MappedFile file(path);
+    if(file.data == NULL) {Rcpp::stop("Could not read the snapshot " + path + ".");}
+
+    SnapshotHeader header;
+    const SnapshotHeader expected = make_header();
+    if(file.size < sizeof(header)) {Rcpp::stop(path + " is not a snapshot.");}
+    memcpy(&header, file.data, sizeof(header));
+    if(memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) {Rcpp::stop(path + " is not a snapshot.");}
+    if(header.version != SNAPSHOT_VERSION) {
+        Rcpp::stop("The snapshot was written by another version of SITH (format " +
+                   std::to_string(header.version) + ", expected " + std::to_string(SNAPSHOT_VERSION) + ").");
+    }
+    if(memcmp(&header, &expected, sizeof(header)) != 0) {
+        Rcpp::stop("The snapshot was written on a different platform.");
+    }
+
+    //find the sections
+    Section sections[SECTION_COUNT];
+    memset(sections, 0, sizeof(sections));
+    size_t pos = sizeof(header);
+    while(pos + sizeof(SectionHeader) <= file.size) {
+        SectionHeader sh;
+        memcpy(&sh, file.data + pos, sizeof(sh));
+        pos += sizeof(sh);
+        if(sh.bytes > file.size - pos) {Rcpp::stop("The snapshot is truncated.");}
+        //sections this version does not know about are skipped
+        if(sh.tag < SECTION_COUNT) {
+            sections[sh.tag].data = file.data + pos;
+            sections[sh.tag].bytes = sh.bytes;
+        }
+        pos += sh.bytes + (8 - sh.bytes % 8) % 8;
+    }
+    if(sections[SECTION_STATE].bytes != sizeof(SnapshotState) || sections[SECTION_SAMPLER].bytes != sizeof(RateSampler::Sums)) {
+        Rcpp::stop("The snapshot is corrupted.");
+    }
+
+    SnapshotState state;
+    memcpy(&state, sections[SECTION_STATE].data, sizeof(state));
+    SimParams p;
+    p.tumor_size = state.tumor_size;
+    p.wt_br = state.wt_br; p.wt_dr = state.wt_dr;
+    p.u = state.u; p.du = state.du; p.s = state.s;
+    p.recurrent_size = state.recurrent_size; p.tr = state.tr;
+    p.verbose = false;
+    p.csr = false;
+    p.nthreads = 1;
+    p.checkpoint_every = 0;
+
+    ctx.time = state.time;
+    ctx.phase = state.phase;
+    ctx.total_death_rate = state.total_death_rate;
+    ctx.d_max = state.d_max;
+    ctx.uniform = state.uniform;
+    ctx.b_max = state.b_max;
+    ctx.window_draws = state.window_draws;
+    ctx.window_events = state.window_events;
+    ctx.window_size = state.window_size;
+    ctx.total_mutations = state.total_mutations;
+    ctx.rng.seed(state.rng);
+
+    read_array(sections[SECTION_CELLS], ctx.cells);
+
+    std::vector<SnapshotSpecie> records;
+    read_array(sections[SECTION_SPECIES], records);
+    const int* genotypes = (const int*) sections[SECTION_GENOTYPES].data;
+    const size_t ngenotype = sections[SECTION_GENOTYPES].bytes/sizeof(int);
+    size_t offset = 0;
+    ctx.species.resize(records.size());
+    for(size_t i = 0; i < records.size(); ++i) {
+        const SnapshotSpecie &rec = records[i];
+        specie &sp = ctx.species[i];
+        sp.id = rec.id; sp.count = rec.count; sp.parent = rec.parent; sp.nmuts = rec.nmuts;
+        sp.b = rec.b; sp.d = rec.d;
+        sp.red = rec.red; sp.green = rec.green; sp.blue = rec.blue;
+        sp.treatment_resistance = rec.treatment_resistance;
+        if(offset + rec.ngenotype > ngenotype) {Rcpp::stop("The snapshot is corrupted.");}
+        sp.genotype.assign(genotypes + offset, genotypes + offset + rec.ngenotype);
+        offset += rec.ngenotype;
+    }
+
+    ctx.phylo_tree.assign(2, std::vector<int>());
+    read_array(sections[SECTION_PHYLO_PARENTS], ctx.phylo_tree[0]);
+    read_array(sections[SECTION_PHYLO_CHILDREN], ctx.phylo_tree[1]);
+    read_array(sections[SECTION_DRIVERS], ctx.drivers);
+    read_array(sections[SECTION_THERAPY], p.therapy);
+    read_array(sections[SECTION_RESISTANT_STATES], p.resistant_states);
+    read_array(sections[SECTION_DOSES], ctx.doses);
+
+    ctx.G.clear();
+    if(state.udt) {
+        std::vector<int> counts;
+        std::vector<Edge> edges;
+        read_array(sections[SECTION_EDGE_COUNTS], counts);
+        read_array(sections[SECTION_EDGES], edges);
+        size_t e = 0;
+        ctx.G.resize(counts.size());
+        for(size_t i = 0; i < counts.size(); ++i) {
+            if(e + counts[i] > edges.size()) {Rcpp::stop("The snapshot is corrupted.");}
+            ctx.G[i].assign(edges.begin() + e, edges.begin() + e + counts[i]);
+            e += counts[i];
+        }
+        ctx.genotype_index.init(ctx.species, ctx.G.size(), p.resistant_states);
+    }
+
+    RateSampler::Sums sums;
+    memcpy(&sums, sections[SECTION_SAMPLER].data, sizeof(sums));
+    ctx.birth_sampler.restore(ctx.cells, ctx.species, sums);
+
+    const Section &slots = sections[SECTION_LATTICE_SLOTS];
+    const Section &chunks = sections[SECTION_LATTICE_CHUNKS];
+    const size_t nchunks = slots.bytes/sizeof(uint64_t);
+    if(chunks.bytes != nchunks*sizeof(Chunk)) {Rcpp::stop("The snapshot is corrupted.");}
+    ctx.lattice.restore(state.lattice_lo, state.lattice_n);
+    for(size_t i = 0; i < nchunks; ++i) {
+        uint64_t slot;
+        memcpy(&slot, slots.data + i*sizeof(uint64_t), sizeof(slot));
+        if(slot >= ctx.lattice.slots()) {Rcpp::stop("The snapshot is corrupted.");}
+        ctx.lattice.restore_chunk(slot, *(const Chunk*)(chunks.data + i*sizeof(Chunk)));
+    }
+    return p;
+}
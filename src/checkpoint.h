@@ -0,0 +1,88 @@
+/*
+SITH: An R package for visualizing and analyzing a spatial model of intra-tumor heterogeneity
+Author: Phillip Nicol
+License: GPL-2
+*/
+
+/***********************************************************
+Checkpoints of a running simulation. A snapshot holds everything in the SimContext (cells, species,
+mutations, lattice, the sums of the event channels and the state of the random number generator),
+so a simulation resumed from it continues exactly as if it had never stopped.
+The file is written in the byte order of the machine: a header, then a list of sections which each
+hold one array, starting on an 8 byte boundary. Loading maps the file into memory and copies the
+arrays into place, and the lattice chunks and cells are copied as they are, without being rebuilt.
+The buckets of the birth sampler are rebuilt from the bucket and position stored with every cell.
+A snapshot only replaces the old one once it is complete (see fileformat.h). SNAPSHOT_VERSION is
+increased whenever the layout changes, and snapshots of another version are refused rather than misread.
+Only simulations that use the in-package generator can be checkpointed, since the state of R's
+generator is not ours to save.
+*******************************************************/
+
+#ifndef CHECKPOINT_H_INCLUDED
+#define CHECKPOINT_H_INCLUDED
+
+#include<string>
+#include<chrono>
+#include"context.h"
+
+//version 2 stores the treatment and the event selection of the engine, version 1 snapshots are refused
+#define SNAPSHOT_VERSION 2
+
+namespace Checkpoint {
+    void write(const SimContext &ctx, const SimParams &p, const std::string &path);
+    //load the snapshot at path into ctx, returns the parameters the simulation was started with
+    SimParams read(SimContext &ctx, const std::string &path);
+}
+
+//Writes snapshots while the tumor grows: the first time the population reaches each of
+//p.checkpoint_sizes, every p.checkpoint_every seconds, and at the end of the simulation
+class Checkpointer {
+public:
+    Checkpointer(const SimParams &p) : next(0) {
+        sizes = p.checkpoint.empty() ? std::vector<double>() : p.checkpoint_sizes;
+        every = p.checkpoint.empty() ? 0 : p.checkpoint_every;
+        next_size = next < sizes.size() ? sizes[next] : HUGE_VAL;
+        last = std::chrono::steady_clock::now();
+    }
+
+    //called after every event, the time is only looked at by poll (see Progress::due)
+    inline void step(SimContext &ctx, const SimParams &p) {
+        if(ctx.cells.size() >= next_size) {poll(ctx, p);}
+    }
+
+    //write a snapshot if a size has been reached or enough time has passed
+    void poll(SimContext &ctx, const SimParams &p) {
+        bool due = false;
+        while(ctx.cells.size() >= next_size) {
+            due = true;
+            ++next;
+            next_size = next < sizes.size() ? sizes[next] : HUGE_VAL;
+        }
+        if(every > 0 && seconds() >= every) {due = true;}
+        if(due) {save(ctx, p);}
+    }
+
+    //the simulation is over
+    void finish(SimContext &ctx, const SimParams &p) {
+        if(!p.checkpoint.empty()) {save(ctx, p);}
+    }
+
+private:
+    std::vector<double> sizes;
+    size_t next;
+    double next_size;
+    double every;
+    std::chrono::steady_clock::time_point last;
+
+    double seconds() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - last).count();
+    }
+
+    void save(SimContext &ctx, const SimParams &p) {
+        Checkpoint::write(ctx, p, p.checkpoint);
+        if(p.verbose) {Rcpp::Rcout << "Checkpoint written at " << ctx.cells.size() << " cells. \n";}
+        last = std::chrono::steady_clock::now();
+    }
+};
+
+#endif
@@ -0,0 +1,139 @@
+/*
+SITH: An R package for visualizing and analyzing a spatial model of intra-tumor heterogeneity
+Author: Phillip Nicol
+License: GPL-2
+*/
+
+/***********************************************************
+Everything a running simulation reads and writes lives in a SimContext: the cells and species,
+the lattice, the two event channels, the record of mutations and the random number stream.
+The engine does not keep any state of its own, so two contexts can be simulated at the same
+time (for instance one per thread). A context should be initialized with SimUtils::initIA or
+SimUtils::initUDT before it is used.
+The helpers at the bottom of this file keep the event channels in sync with the lattice.
+*******************************************************/
+
+#ifndef CONTEXT_H_INCLUDED
+#define CONTEXT_H_INCLUDED
+
+#include"simutils.h"
+#include"sampler.h"
+#include"genotypes.h"
+#include"recorder.h"
+#include"stats.h"
+#include"stopping.h"
+
+struct SimContext {
+    //population
+    std::vector<cell> cells;
+    std::vector<specie> species;
+    double time;
+    //number of doses of therapy given so far, and the tumor around each of them
+    int phase;
+    std::vector<DoseRecord> doses;
+
+    //space and the two event channels
+    Lattice lattice;
+    RateSampler birth_sampler;
+    double total_death_rate;
+    //Death rates are inherited from the wild type so d_max never changes
+    double d_max;
+    //while uniform is set the channels are not kept up to date, and cells are drawn uniformly from all cells
+    //instead (see gillespie.h). b_max is at least the birth rate of every cell in that case
+    bool uniform;
+    double b_max;
+    //draws, and draws that led to an event, since the selection was last chosen, and the draws until it is chosen again
+    double window_draws, window_events, window_size;
+
+    //mutations (infinite alleles)
+    int total_mutations;
+    std::vector<int> drivers;
+    std::vector<std::vector<int> > phylo_tree;
+
+    //disease model (user defined)
+    std::vector<std::vector<Edge> > G;
+    GenotypeIndex genotype_index;
+
+    RandomStream rng;
+
+    //clone dynamics recorded during growth
+    Recorder history;
+    //conditions that end the run early
+    StopRule stop_rule;
+
+    //counters of this run
+    RunStats stats;
+    //why the run stopped before the tumor reached its size (empty if it did not), see progress.h and stopping.h
+    std::string stopped;
+};
+
+inline int selectBirthIndex(SimContext &ctx)
+{
+    return ctx.birth_sampler.sample(ctx.rng);
+}
+
+inline int selectDeathIndex(SimContext &ctx)
+{
+    int trial;
+    double u_trial;
+
+    while(true)
+    {
+        ++ctx.stats.death_draws;
+        trial = ctx.rng.runif(0, ctx.cells.size());
+        u_trial = ctx.rng.runif(0, ctx.d_max);
+
+        if(u_trial < ctx.species[ctx.cells[trial].id].d)
+        {
+            return trial;
+        }
+    }
+}
+
+//append a record to the history of the tumor if one is due (or in any case if force is set)
+inline void record_history(SimContext &ctx, const bool force = false)
+{
+    if(force || ctx.history.due(ctx.time, ctx.cells.size())) {
+        ctx.history.record(ctx.time, ctx.cells.size(), ctx.species, ctx.species.size(), ctx.drivers);
+    }
+}
+
+//end the run if the stop rule holds (the counts of the rule must be up to date)
+inline void check_stop(SimContext &ctx)
+{
+    if(ctx.stop_rule.active()) {
+        ctx.stop_rule.check(ctx.time, ctx.cells.size(), ctx.drivers.size(), ctx.species, ctx.stopped);
+    }
+}
+
+//memory held by the tumor right now, for the stats of the run
+inline void note_memory(SimContext &ctx)
+{
+    ctx.stats.note_memory(ctx.lattice, ctx.cells, ctx.species);
+}
+
+//the cell at index gained a free neighbor
+inline void add_boundary(SimContext &ctx, const int index)
+{
+    ctx.birth_sampler.insert(ctx.cells, index, ctx.species[ctx.cells[index].id].b);
+}
+
+//the cell at index lost its last free neighbor (or died)
+inline void remove_boundary(SimContext &ctx, const int index)
+{
+    ctx.birth_sampler.remove(ctx.cells, index);
+}
+
+//the cell at index has changed from species old_id to a new species
+inline void retype_cell(SimContext &ctx, const int index, const int old_id)
+{
+    std::vector<cell> &cells = ctx.cells;
+    const specie &new_species = ctx.species[cells[index].id];
+    if(cells[index].bucket != -1) {
+        ctx.birth_sampler.remove(cells, index);
+        ctx.birth_sampler.insert(cells, index, new_species.b);
+    }
+    ctx.total_death_rate += new_species.d - ctx.species[old_id].d;
+}
+
+#endif
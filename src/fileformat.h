@@ -0,0 +1,39 @@
+/*
+SITH: An R package for visualizing and analyzing a spatial model of intra-tumor heterogeneity
+Author: Phillip Nicol
+License: GPL-2
+*/
+
+/***********************************************************
+What the binary files written by the engine (snapshots and cell files) have in common. They are
+written in the byte order of the machine, with a marker in the header so that a file from a machine
+with another byte order is recognized when it is read. They are written to a temporary file next to
+their path, which then replaces the old file, so an interrupted write never leaves a broken file behind.
+*******************************************************/
+
+#ifndef FILEFORMAT_H_INCLUDED
+#define FILEFORMAT_H_INCLUDED
+
+#include<cstdio>
+#include<string>
+
+//written as 0x01020304, so a file from a machine with another byte order is recognized
+#define BYTE_ORDER_MARK 0x01020304
+
+//the file a file is written to before it replaces path
+inline std::string temporary_path(const std::string &path) {return path + ".tmp";}
+
+//replace path with the complete file at tmp, false (and tmp removed) if that fails
+inline bool replace_file(const std::string &tmp, const std::string &path) {
+#ifdef _WIN32
+    //rename does not replace an existing file on Windows
+    remove(path.c_str());
+#endif
+    if(rename(tmp.c_str(), path.c_str()) != 0) {
+        remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+#endif
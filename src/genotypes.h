@@ -0,0 +1,121 @@
+/*
+SITH: An R package for visualizing and analyzing a spatial model of intra-tumor heterogeneity
+Author: Phillip Nicol
+License: GPL-2
+*/
+
+/***********************************************************
+Under a user defined disease model a genotype is the set of vertices of the DAG that a cell
+has reached, stored as a sorted vector. Two cells with the same set belong to the same species.
+Genotypes are interned in a hash table, so the species of a new genotype is found without
+comparing against every species. On top of that, the species reached from species i by
+gaining vertex v is cached the first time it is computed. Repeated transitions (which are
+almost all of them) then cost one hash lookup and do not allocate.
+A species is resistant to treatment if its genotype has any of the resistant states. A new genotype
+is its parent's plus one vertex, so it is resistant if its parent is or if the vertex is resistant.
+*******************************************************/
+
+#ifndef GENOTYPES_H_INCLUDED
+#define GENOTYPES_H_INCLUDED
+
+#include<stdint.h>
+#include<unordered_map>
+#include"simutils.h"
+
+struct GenotypeHash {
+    size_t operator()(const std::vector<int> &gtype) const {
+        //FNV-1a over the vertices
+        uint64_t h = 14695981039346656037ULL;
+        for(size_t i = 0; i < gtype.size(); ++i) {
+            h ^= (uint32_t)gtype[i];
+            h *= 1099511628211ULL;
+        }
+        return (size_t)h;
+    }
+};
+
+class GenotypeIndex {
+public:
+    GenotypeIndex() : nv(0), nlookups(0), nhits(0) {}
+
+    //index the existing species of a disease model with nvertices vertices, and mark those that have
+    //any of the (sorted) resistant states
+    void init(std::vector<specie> &species, const int nvertices, const std::vector<int> &resistant_states) {
+        ids.clear();
+        transitions.clear();
+        nv = nvertices;
+        nlookups = 0; nhits = 0;
+        resistant.assign(nv, false);
+        for(int i = 0; i < resistant_states.size(); ++i) {
+            if(resistant_states[i] >= 0 && resistant_states[i] < nv) {resistant[resistant_states[i]] = true;}
+        }
+        for(int i = 0; i < species.size(); ++i) {
+            ids[species[i].genotype] = i;
+            species[i].treatment_resistance = false;
+            for(int g = 0; g < species[i].genotype.size(); ++g) {
+                if(resistant[species[i].genotype[g]]) {species[i].treatment_resistance = true;}
+            }
+        }
+    }
+
+    //Species with the genotype of parent plus vertex head. This is parent itself if the vertex has
+    //already been reached. A genotype that has not been seen before becomes a new species with rates b,d
+    inline int child(std::vector<specie> &species, const int parent, const int head, const double b, const double d) {
+        const uint64_t key = (uint64_t)parent*nv + head;
+        ++nlookups;
+        std::unordered_map<uint64_t, int>::const_iterator it = transitions.find(key);
+        if(it != transitions.end()) {++nhits; return it->second;}
+
+        int id = parent;
+        const std::vector<int> &pgtype = species[parent].genotype;
+        std::vector<int>::const_iterator pos = std::lower_bound(pgtype.begin(), pgtype.end(), head);
+        if(pos == pgtype.end() || *pos != head) {
+            std::vector<int> gtype;
+            gtype.reserve(pgtype.size() + 1);
+            gtype.insert(gtype.end(), pgtype.begin(), pos);
+            gtype.push_back(head);
+            gtype.insert(gtype.end(), pos, pgtype.end());
+
+            std::unordered_map<std::vector<int>, int, GenotypeHash>::const_iterator found = ids.find(gtype);
+            if(found != ids.end()) {
+                id = found->second;
+            }
+            else {
+                //New genotype
+                specie new_specie;
+                new_specie.b = b;
+                new_specie.d = d;
+                new_specie.id = species.size();
+                new_specie.count = 0;
+                new_specie.parent = -1;
+                new_specie.nmuts = gtype.size();
+                new_specie.treatment_resistance = species[parent].treatment_resistance || resistant[head];
+                new_specie.red = species[parent].red;
+                new_specie.green = species[parent].green;
+                new_specie.blue = species[parent].blue;
+                id = new_specie.id;
+                ids[gtype] = id;
+                new_specie.genotype.swap(gtype);
+                species.push_back(new_specie);
+            }
+        }
+        transitions[key] = id;
+        return id;
+    }
+
+    size_t size() const {return ids.size();}
+
+    //calls to child since init, and those answered from the cache of transitions
+    double lookups() const {return nlookups;}
+    double hits() const {return nhits;}
+
+private:
+    std::unordered_map<std::vector<int>, int, GenotypeHash> ids;
+    std::unordered_map<uint64_t, int> transitions;
+    //whether each vertex makes a cell resistant
+    std::vector<bool> resistant;
+    int nv;
+    double nlookups, nhits;
+};
+
+#endif
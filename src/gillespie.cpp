@@ -1,125 +1,177 @@
 #include"gillespie.h"
 
-void Gillespie::gillespieIA(std::vector<cell> &cells, std::vector<specie> &species, const int index, double &time,
-                const double wt_dr, const double u, const double du, const double s, const double tr) {
-
-    //Update time--approximate 
-    double lambda = 1/(cells.size()*p_max);
-    time += R::rexp(lambda);
-
-    //Randomly selected cell (from previous step)
-    cell cell = cells[index];
-
-    //Find the allele of the chosen cell 
-    specie cell_species = species[cell.id];
-
-    //Look at the neighbors of the cell and find a (random) neighbor
-    //If no random neighbor, key = 0
-    int key = random_neighbor(cell);
-    if(key != 0)
-    {
-        //key != 0 so there is at least one free neighbor
-        //Probability of birth event
-        int bd = R::rbinom(1,cell_species.b/(cell_species.b + cell_species.d));
-        if(bd == 1) {
-            //Birth
-            update_lattice(cell, key, lattice);
-            struct cell new_cell = birth_cellIA(cells[index], key, cell_species, species, wt_dr, u, du, s, tr);
-            cells.push_back(new_cell);         
+//kinds of the next event
+enum {NO_EVENT, BIRTH, DEATH};
+
+//Draw the next event and advance the clock to it. The cell it happens to is stored in index, and for a birth
+//the neighbor the daughter goes to in key. Draws of uniform selection can be rejected (NO_EVENT), in which case
+//the clock still moves on. An event after until is not carried out and the clock stops at until instead, which
+//does not change the process since the waiting times are memoryless
+static inline int next_event(SimContext &ctx, const double until, int &index, int &key) {
+    std::vector<cell> &cells = ctx.cells;
+    if(ctx.window_draws >= ctx.window_size) {
+        Gillespie::choose_selection(ctx);
+    }
+    ++ctx.window_draws;
+
+    if(ctx.uniform) {
+        //every cell is drawn at rate b_max + d_max, and the draw is thinned to the rates of the cell
+        const double rate = ctx.b_max + ctx.d_max;
+        ctx.time += ctx.rng.rexp(1/(cells.size()*rate));
+        if(ctx.time > until) {
+            ctx.time = until;
+            return NO_EVENT;
         }
-        else
-        {
-            //Death
-            if(cells.size() > 1) {
-                //Free up the space in the lattice
-                lattice[cell.x][cell.y][cell.z] = 0;
-                //remove cell from list
-                std::swap(cells[index], cells.back());
-                cells.pop_back();   
-                --species[cell.id].count;    
+        index = ctx.rng.runif(0, cells.size());
+        const specie &sp = ctx.species[cells[index].id];
+        const double u = ctx.rng.runif(0, rate);
+        if(u < ctx.b_max) {
+            ++ctx.stats.birth_draws;
+            //an interior cell has no free neighbor and can not divide
+            key = u < sp.b ? random_neighbor(ctx.rng, ctx.lattice, cells[index]) : 0;
+            if(key == 0) {
+                ++ctx.stats.birth_rejections;
+                return NO_EVENT;
             }
+            ++ctx.window_events;
+            return BIRTH;
         }
-    }
-    else
-    {
-        //Key = 0 and the cell has no free neighbors
-        //No birth can occur, but the cell could still die
-        int bd = R::rbinom(1,cell_species.b/(cell_species.b + cell_species.d));
-        if(bd == 0)
-        {
-            //Death
-            if(cells.size() > 1)
-            {
-                //procedure same as above
-                lattice[cell.x][cell.y][cell.z] = 0;
-                std::swap(cells[index], cells.back());
-                cells.pop_back();
-                --species[cell.id].count;
-            }        
+        ++ctx.stats.death_draws;
+        if(u - ctx.b_max < sp.d) {
+            ++ctx.window_events;
+            return DEATH;
         }
+        return NO_EVENT;
+    }
+
+    //Total rate of births (from boundary cells) and deaths (from any cell)
+    double total_rate = ctx.birth_sampler.total() + ctx.total_death_rate;
+    ctx.time += ctx.rng.rexp(1/total_rate);
+    if(ctx.time > until) {
+        ctx.time = until;
+        return NO_EVENT;
+    }
+    ++ctx.window_events;
+
+    if(ctx.rng.runif(0, total_rate) < ctx.birth_sampler.total()) {
+        //The chosen cell is on the boundary so it has at least one free neighbor
+        index = selectBirthIndex(ctx);
+        key = random_neighbor(ctx.rng, ctx.lattice, cells[index]);
+        return BIRTH;
+    }
+    index = selectDeathIndex(ctx);
+    return DEATH;
+}
+
+//the new cell born from the cell at index, whose species was parent_id before the division, is placed on the lattice
+static inline void place_daughter(SimContext &ctx, const int index, const int parent_id, const cell &new_cell) {
+    std::vector<cell> &cells = ctx.cells;
+    std::vector<specie> &species = ctx.species;
+    if(cells[index].id != parent_id) {
+        //the original cell mutated
+        retype_cell(ctx, index, parent_id);
     }
+    cells.push_back(new_cell);
+    ctx.total_death_rate += species[new_cell.id].d;
+    ctx.b_max = std::max(ctx.b_max, std::max(species[new_cell.id].b, species[cells[index].id].b));
+    update_lattice(ctx, cells.size() - 1);
+    ctx.stop_rule.birth(species, new_cell.id, cells[index].id, parent_id);
+    ++ctx.stats.births;
 }
 
-void Gillespie::gillespieUDT(std::vector<cell> &cells, std::vector<specie> &species, const int index, double &time) {
+//the cell at index dies
+static inline void remove_cell(SimContext &ctx, const int index) {
+    //the last cell is kept alive, unless the run stops at extinction
+    if(ctx.cells.size() > 1 || ctx.stop_rule.extinction()) {
+        ctx.stop_rule.death(ctx.species, ctx.cells[index].id);
+        kill_cell(ctx, index);
+        ++ctx.stats.deaths;
+    } else {
+        ++ctx.stats.skipped_deaths;
+    }
+}
 
-    //Update time--approximate 
-    double lambda = 1/(cells.size()*p_max);
-    time += R::rexp(lambda);
+void Gillespie::gillespieIA(SimContext &ctx, const double until, const double wt_dr, const double u, const double du,
+                            const double s, const double tr) {
+    int index, key;
+    const int event = next_event(ctx, until, index, key);
+    if(event == NO_EVENT) {return;}
+    ++ctx.stats.events;
+
+    if(event == BIRTH) {
+        const int parent_id = ctx.cells[index].id;
+        struct cell new_cell = birth_cellIA(ctx, ctx.cells[index], key, wt_dr, u, du, s, tr);
+        place_daughter(ctx, index, parent_id, new_cell);
+    } else {
+        remove_cell(ctx, index);
+    }
+}
 
-    //Randomly selected cell (from previous step)
-    cell cell = cells[index];
+void Gillespie::gillespieUDT(SimContext &ctx, const double until) {
+    int index, key;
+    const int event = next_event(ctx, until, index, key);
+    if(event == NO_EVENT) {return;}
+    ++ctx.stats.events;
+
+    if(event == BIRTH) {
+        const int parent_id = ctx.cells[index].id;
+        struct cell new_cell = birth_cellUDT(ctx, ctx.cells[index], key);
+        place_daughter(ctx, index, parent_id, new_cell);
+    } else {
+        remove_cell(ctx, index);
+    }
+}
 
-    //Find the type of the chosen cell 
-    specie cell_species = species[cell.id];
-
-    //Look at the neighbors of the cell and find a (random) neighbor
-    //If no random neighbor, key = 0
-    int key = random_neighbor(cell);
-    if(key != 0)
-    {
-        //key != 0 so there is at least one free neighbor
-        //Probability of birth event
-        int bd = R::rbinom(1,cell_species.b/(cell_species.b + cell_species.d));
-        if(bd == 1) {
-            //Birth
-            update_lattice(cell, key, lattice);
-            struct cell new_cell = birth_cellUDT(cells[index], key, cell_species, species);
-            cells.push_back(new_cell);         
+void Gillespie::choose_selection(SimContext &ctx) {
+    std::vector<cell> &cells = ctx.cells;
+    const double n = cells.size();
+    if(ctx.uniform) {
+        if(ctx.window_events < UNIFORM_ACCEPTANCE*ctx.window_draws) {
+            SimUtils::rebuild_channels(ctx, 1);
         }
-        else
-        {
-            //Death
-            if(cells.size() > 1) {
-                //Free up the space in the lattice
-                lattice[cell.x][cell.y][cell.z] = 0;
-                //remove cell from list
-                std::swap(cells[index], cells.back());
-                cells.pop_back();   
-                --species[cell.id].count;    
-            }
+    } else if(n > 0) {
+        //the largest birth rate of a living cell
+        double b_max = 0;
+        for(size_t i = 0; i < ctx.species.size(); ++i) {
+            if(ctx.species[i].count > 0) {b_max = std::max(b_max, ctx.species[i].b);}
         }
-    }
-    else
-    {
-        //Key = 0 and the cell has no free neighbors
-        //No birth can occur, but the cell could still die
-        int bd = R::rbinom(1,cell_species.b/(cell_species.b + cell_species.d));
-        if(bd == 0)
-        {
-            //Death
-            if(cells.size() > 1)
-            {
-                //procedure same as above
-                lattice[cell.x][cell.y][cell.z] = 0;
-                std::swap(cells[index], cells.back());
-                cells.pop_back();
-                --species[cell.id].count;
-            }        
+        //the fraction of the draws of uniform selection that would lead to an event
+        const double acceptance = (ctx.birth_sampler.total() + ctx.total_death_rate)/(n*(b_max + ctx.d_max));
+        if(acceptance > UNIFORM_ACCEPTANCE) {
+            ctx.stats.add_sampler(ctx.birth_sampler);
+            ctx.birth_sampler.clear();
+            for(size_t i = 0; i < cells.size(); ++i) {cells[i].bucket = -1;}
+            ctx.uniform = true;
+            ctx.b_max = b_max;
         }
     }
+    ctx.window_draws = 0;
+    ctx.window_events = 0;
+    ctx.window_size = std::max(n, (double)SELECTION_WINDOW);
 }
 
-cell birth_cellIA(cell &cell, const int key, const specie cell_species, std::vector<specie> &species, 
+void kill_cell(SimContext &ctx, const int index) {
+    std::vector<cell> &cells = ctx.cells;
+    std::vector<specie> &species = ctx.species;
+    cell cell = cells[index];
+
+    //Free up the space in the lattice
+    remove_boundary(ctx, index);
+    vacate_lattice(ctx, index);
+    ctx.total_death_rate -= species[cell.id].d;
+    --species[cell.id].count;
+
+    //remove cell from list, the last cell takes its place
+    int last = cells.size() - 1;
+    if(index != last) {
+        cells[index] = cells[last];
+        ctx.lattice.reindex(cells[index].x, cells[index].y, cells[index].z, index);
+        ctx.birth_sampler.move(cells, index);
+    }
+    cells.pop_back();
+}
+
+cell birth_cellIA(SimContext &ctx, cell &cell, const int key, 
                             const double wt_dr, const double u, const double du, const double s,
                             const double tr) {
     //form new cell 
@@ -136,62 +188,67 @@ cell birth_cellIA(cell &cell, const int key, const specie cell_species, std::vec
         case 4: --new_cell.y; break; 
         case 5: ++new_cell.z; break; 
         case 6: --new_cell.z; break; 
-        default: Rcpp::stop("Algorithm internal error.");
+        //not Rcpp::stop, the replicates of a batch are simulated on worker threads
+        default: throw std::logic_error("Algorithm internal error.");
     }
 
+    //species can grow below, so the parent is always read through its index
+    std::vector<specie> &species = ctx.species;
+    const int parent = cell.id;
+
     //daughter cell 
     //Receieve a poisson number of genetic alterations 
-    int nmuts = R::rpois(u);
+    int nmuts = ctx.rng.rpois(u);
     if(nmuts > 0) {
         specie new_species;
         new_species.id = species.size(); 
-        std::vector<int> new_gt = cell_species.genotype;
-        double br = cell_species.b;
+        //the new specie only stores its own mutations
+        new_species.parent = parent;
+        double br = species[parent].b;
+        //the mutations of a division follow each other in the phylogenetic tree
+        int previous = species[parent].genotype.back();
         for(int i = 0; i < nmuts; ++i) {
-            ++total_mutations;
-            new_gt.push_back(total_mutations); 
+            ++ctx.total_mutations;
+            new_species.genotype.push_back(ctx.total_mutations); 
 
-            phylo_tree[0].push_back(cell_species.genotype.back());
-            phylo_tree[1].push_back(total_mutations); 
+            ctx.phylo_tree[0].push_back(previous);
+            ctx.phylo_tree[1].push_back(ctx.total_mutations); 
+            previous = ctx.total_mutations;
 
-            if((int)R::rbinom(1,du) == 1) {
+            if(ctx.rng.rbern(du) == 1) {
                 //apply multiplicative update
                 br *= s;
-                drivers.push_back(total_mutations);          
+                ctx.drivers.push_back(ctx.total_mutations);          
             }
         }
         new_species.b = br;
         new_species.d = wt_dr;
-        new_species.genotype = new_gt;
+        new_species.nmuts = species[parent].nmuts + nmuts;
         new_species.count = 1;
 
-        if(new_species.b + wt_dr > p_max) {
-            p_max = new_species.b + wt_dr;
-        }
-
-        new_species.treatment_resistance = cell_species.treatment_resistance;
-        int treatment_resistance = R::rbinom(1,tr);
+        new_species.treatment_resistance = species[parent].treatment_resistance;
+        int treatment_resistance = ctx.rng.rbern(tr);
         if(treatment_resistance == 1) {
             new_species.treatment_resistance = true; 
         } 
 
-        new_species.red = cell_species.red + R::rnorm(0,0.05);
+        new_species.red = species[parent].red + ctx.rng.rnorm(0,0.05);
         if(new_species.red > 1) {
-            new_species.red = 1-R::rnorm(0,0.05);
+            new_species.red = 1-ctx.rng.rnorm(0,0.05);
         } else if(new_species.red < 0) {
-            new_species.red = abs(R::rnorm(0,0.05));
+            new_species.red = abs(ctx.rng.rnorm(0,0.05));
         }
-        new_species.green = cell_species.green + R::rnorm(0,0.05);
+        new_species.green = species[parent].green + ctx.rng.rnorm(0,0.05);
         if(new_species.green > 1) {
-            new_species.green = 1-R::rnorm(0,0.05);
+            new_species.green = 1-ctx.rng.rnorm(0,0.05);
         } else if(new_species.green < 0) {
-            new_species.green = abs(R::rnorm(0,0.05));
+            new_species.green = abs(ctx.rng.rnorm(0,0.05));
         }
-        new_species.blue = cell_species.blue + R::rnorm(0,0.05);
+        new_species.blue = species[parent].blue + ctx.rng.rnorm(0,0.05);
         if(new_species.blue > 1) {
-            new_species.blue = 1-R::rnorm(0,0.05);
+            new_species.blue = 1-ctx.rng.rnorm(0,0.05);
         } else if(new_species.red < 0) {
-            new_species.blue = abs(R::rnorm(0,0.05));
+            new_species.blue = abs(ctx.rng.rnorm(0,0.05));
         }
 
         species.push_back(new_species);
@@ -200,67 +257,65 @@ cell birth_cellIA(cell &cell, const int key, const specie cell_species, std::vec
     }
     else {
         //If no mutation, the cell inherits all of the qualities of its parent
-        new_cell.id = cell_species.id; 
+        new_cell.id = parent; 
         ++species[cell.id].count;
     }
 
     //original cell may mutate as well
-    nmuts = R::rpois(u);
+    nmuts = ctx.rng.rpois(u);
     if(nmuts > 0) {
         specie new_species;
         new_species.id = species.size(); 
-        std::vector<int> new_gt = cell_species.genotype;
+        new_species.parent = parent;
             
-        double br = cell_species.b;
+        double br = species[parent].b;
+        //the mutations of a division follow each other in the phylogenetic tree
+        int previous = species[parent].genotype.back();
         for(int i = 0; i < nmuts; ++i) {
-            ++total_mutations;
-            new_gt.push_back(total_mutations); 
+            ++ctx.total_mutations;
+            new_species.genotype.push_back(ctx.total_mutations); 
 
-            phylo_tree[0].push_back(cell_species.genotype.back());
-            phylo_tree[1].push_back(total_mutations); 
+            ctx.phylo_tree[0].push_back(previous);
+            ctx.phylo_tree[1].push_back(ctx.total_mutations); 
+            previous = ctx.total_mutations;
 
-            if((int)R::rbinom(1,du) == 1) {
+            if(ctx.rng.rbern(du) == 1) {
                 //apply multiplicative update
                 br *= s;
-                drivers.push_back(total_mutations);          
+                ctx.drivers.push_back(ctx.total_mutations);          
             }
         }
         new_species.b = br;
         new_species.d = wt_dr;
-        new_species.genotype = new_gt;
+        new_species.nmuts = species[parent].nmuts + nmuts;
         new_species.count = 1;
 
-        if(new_species.b + wt_dr > p_max)
-        {
-            p_max = new_species.b + wt_dr;
-        }
-
-        new_species.treatment_resistance = cell_species.treatment_resistance;
-        int treatment_resistance = R::rbinom(1,tr);
+        new_species.treatment_resistance = species[parent].treatment_resistance;
+        int treatment_resistance = ctx.rng.rbern(tr);
         if(treatment_resistance == 1) {
             new_species.treatment_resistance = true; 
         } 
 
-        new_species.red = cell_species.red + R::rnorm(0,0.05);
+        new_species.red = species[parent].red + ctx.rng.rnorm(0,0.05);
         if(new_species.red > 1) {
-            new_species.red = 1-R::rnorm(0,0.05);
+            new_species.red = 1-ctx.rng.rnorm(0,0.05);
         } else if(new_species.red < 0) {
-            new_species.red = abs(R::rnorm(0,0.05));
+            new_species.red = abs(ctx.rng.rnorm(0,0.05));
         }
-        new_species.green = cell_species.green + R::rnorm(0,0.05);
+        new_species.green = species[parent].green + ctx.rng.rnorm(0,0.05);
         if(new_species.green > 1) {
-            new_species.green = 1-R::rnorm(0,0.05);
+            new_species.green = 1-ctx.rng.rnorm(0,0.05);
         } else if(new_species.green < 0) {
-            new_species.green = abs(R::rnorm(0,0.05));
+            new_species.green = abs(ctx.rng.rnorm(0,0.05));
         }
-        new_species.blue = cell_species.blue + R::rnorm(0,0.05);
+        new_species.blue = species[parent].blue + ctx.rng.rnorm(0,0.05);
         if(new_species.blue > 1) {
-            new_species.blue = 1-R::rnorm(0,0.05);
+            new_species.blue = 1-ctx.rng.rnorm(0,0.05);
         } else if(new_species.red < 0) {
-            new_species.blue = abs(R::rnorm(0,0.05));
+            new_species.blue = abs(ctx.rng.rnorm(0,0.05));
         }
 
-        species[cell_species.id].count--;
+        species[parent].count--;
 
         species.push_back(new_species);
         cell.id = new_species.id;
@@ -270,7 +325,7 @@ cell birth_cellIA(cell &cell, const int key, const specie cell_species, std::vec
 }
 
 
-cell birth_cellUDT(cell &cell, const int key, specie cell_species, std::vector<specie> &species) {
+cell birth_cellUDT(SimContext &ctx, cell &cell, const int key) {
     //form new cell 
     struct cell new_cell;
     new_cell.x = cell.x;
@@ -285,86 +340,38 @@ cell birth_cellUDT(cell &cell, const int key, specie cell_species, std::vector<s
         case 4: --new_cell.y; break; 
         case 5: ++new_cell.z; break; 
         case 6: --new_cell.z; break; 
-        default: Rcpp::stop("Algorithm internal error.");
+        default: throw std::logic_error("Algorithm internal error.");
     }
 
-    bool mutflag = false; 
+    std::vector<specie> &species = ctx.species;
+    const int parent = cell.id;
+    const std::vector<int> &gtype = species[parent].genotype;
 
-    for(std::vector<int>::iterator it = cell_species.genotype.begin(); it != cell_species.genotype.end(); ++it) {
-        for(int j = 0; j < G[*it].size(); ++j) {
-            if((int)R::rbinom(1,G[*it][j].u)) {
+    //species can grow, but only right before we return, so gtype stays valid in the loop
+    for(int g = 0; g < gtype.size(); ++g) {
+        const std::vector<Edge> &edges = ctx.G[gtype[g]];
+        for(int j = 0; j < edges.size(); ++j) {
+            if(ctx.rng.rbern(edges[j].u)) {
                 //Mutation event 
-                if((int)R::rbinom(1,0.5)) {
+                bool daughter = ctx.rng.rbern(0.5);
+                int sp_id = ctx.genotype_index.child(species, parent, edges[j].head, 
+                                species[parent].b*edges[j].s, species[parent].d);
+                if(sp_id == parent) {
+                    //this state has already been reached
+                    continue; 
+                }
+                ++species[sp_id].count; 
+                if(daughter) {
                     //New daughter cell mutates
-                    std::vector<int> gtype = cell_species.genotype;
-                    gtype = bubblesort(gtype);
-                    if(vin(gtype, G[*it][j].head)) {
-                        continue; 
-                    }
-                    mutflag = true; 
-
-                    gtype.push_back(G[*it][j].head);
-                    gtype = bubblesort(gtype); 
-
-                    int sp_id = find_gtype(species, gtype);
-                    if(sp_id == -1) {
-                        //New genotype
-                        specie new_specie;
-                        new_specie.b = species[cell.id].b*G[*it][j].s;
-                        new_specie.d = species[cell.id].d;
-                        if(new_specie.b + new_specie.d > p_max) {p_max = new_specie.b + new_specie.d;}
-                        new_specie.id = species.size(); 
-                        new_specie.genotype = gtype;
-                        new_specie.count = 1; 
-
-                        new_cell.id = new_specie.id; 
-
-                        species.push_back(new_specie); 
-                    }
-                    else {
-                        new_cell.id = sp_id; 
-                        ++species[sp_id].count; 
-                    }
+                    new_cell.id = sp_id; 
                 }
                 else {
                     //Original cell mutates 
-                    std::vector<int> gtype = cell_species.genotype;
-                    gtype = bubblesort(gtype);
-
-                    if(vin(gtype, G[*it][j].head)) {
-                        continue; 
-                    }
-                    mutflag = true; 
-
                     //the daughter gets what the original cell had
-                    new_cell.id = cell.id;
+                    new_cell.id = parent;
                     //no need to update count since we will subtract it from original cell 
-
-                    gtype.push_back(G[*it][j].head);
-                    gtype = bubblesort(gtype); 
-
-                    int sp_id = find_gtype(species, gtype);
-                    if(sp_id == -1) {
-                        //New genotype
-                        specie new_specie;
-                        new_specie.b = species[cell.id].b*G[*it][j].s;
-                        new_specie.d = species[cell.id].d;
-                        if(new_specie.b + new_specie.d > p_max) {p_max = new_specie.b + new_specie.d;}
-                        new_specie.id = species.size(); 
-                        new_specie.genotype = gtype;
-                        new_specie.count = 1; 
-
-                        cell.id = new_specie.id; 
-
-                        species.push_back(new_specie); 
-                    }
-                    else {
-                        cell.id = sp_id; 
-                        ++species[cell.id].count; 
-                    }
+                    cell.id = sp_id; 
                 }
-            }
-            if(mutflag) {
                 return new_cell; 
             }
         }
@@ -378,23 +385,3 @@ cell birth_cellUDT(cell &cell, const int key, specie cell_species, std::vector<s
 
 
 
-
-int find_gtype(std::vector<specie> &species, std::vector<int> gtype) {
-    for(int i = 0; i < species.size(); ++i) {
-        if(species[i].genotype == gtype) {
-            return i;
-        }
-    }
-    return -1; 
-}
-
-bool vin(std::vector<int> v, int a) {
-    for(int i = 0; i < v.size(); ++i) {
-        if(v[i] == a) {
-            return true;
-        }
-    }
-    return false; 
-}
-
-
@@ -4,31 +4,45 @@ Author: Phillip Nicol
 License: GPL-2 
 */
 
+/***********************************************************
+The two event channels of sampler.h never waste a draw, but keeping them up to date costs a look at the
+six neighbors of every cell that is born or dies. That pays off while the boundary is a small part of
+the tumor, which is the case for a large tumor with little death. With a high death rate the tumor is
+full of holes and most of its cells are on the boundary, so the bookkeeping costs more than it saves.
+In that case cells are drawn by uniform selection instead: a cell j is drawn uniformly from all cells
+at the total rate n*(b_max + d_max), and u ~ U[0, b_max + d_max] is a birth if u < b_j and the cell has a
+free neighbor, a death if b_max <= u < b_max + d_j, and nothing otherwise. This is the same process
+(thinning), and only the lattice itself has to be kept up to date.
+The engine chooses between the two once every SELECTION_WINDOW draws or every n draws, whichever is
+more. Uniform selection is used while more than UNIFORM_ACCEPTANCE of its draws lead to an event; in
+the channels this fraction is known from the total rates. A switch to the channels rebuilds them from
+the lattice, which is O(n) and so costs at most about one event per draw of the window.
+*******************************************************/
+
 #ifndef GILLESPIE_H_INCLUDED
 #define GILLESPIE_H_INCLUDED
 
+#include<stdexcept>
+#include"context.h"
 #include"neighbors.h"
 
-extern double p_max;
-extern std::vector<int> drivers; 
-extern int total_mutations;
-extern int x_dim, y_dim, z_dim; //Size of the lattice (set at the start of simulation to accomodate num of cells)
-
-extern bool*** lattice; 
-extern std::vector<std::vector<int> > phylo_tree;
-extern std::vector<std::vector<Edge> > G; 
+#define SELECTION_WINDOW 4096
+//a draw of uniform selection costs about a quarter of an event of the channels
+#define UNIFORM_ACCEPTANCE 0.3
 
-cell birth_cellIA(cell &cell, const int key, const specie cell_species, std::vector<specie> &species, 
+cell birth_cellIA(SimContext &ctx, cell &cell, const int key, 
                 const double wt_dr, const double u, const double du, const double s, const double tr);
-cell birth_cellUDT(cell &cell, const int key, specie cell_species, std::vector<specie> &species);
+cell birth_cellUDT(SimContext &ctx, cell &cell, const int key);
 
-int find_gtype(std::vector<specie> &species, std::vector<int> gtype);
-bool vin(std::vector<int> v, int a);
+void kill_cell(SimContext &ctx, const int index);
 
 namespace Gillespie {
-    void gillespieIA(std::vector<cell> &cells, std::vector<specie> &species, const int index, double &time,
-                const double wt_dr, const double u, const double du, const double s, const double tr);
-    void gillespieUDT(std::vector<cell> &cells, std::vector<specie> &species, const int index, double &time);
+    //carry out the next event, unless it comes after until (the clock then stops at until)
+    void gillespieIA(SimContext &ctx, const double until, const double wt_dr, const double u, const double du,
+                     const double s, const double tr);
+    void gillespieUDT(SimContext &ctx, const double until);
+    //use uniform selection or the two event channels for the next draws
+    void choose_selection(SimContext &ctx);
 }
 
 
@@ -0,0 +1,228 @@
+/*
+SITH: An R package for visualizing and analyzing a spatial model of intra-tumor heterogeneity
+Author: Phillip Nicol
+License: GPL-2
+*/
+
+/***********************************************************
+Occupancy of the lattice is stored with one bit per site. Sites are grouped into 4x4x4 bricks,
+and each brick is a single 64-bit word, so a site and all of its neighbors are usually in the same
+word (or one word over).
+The lattice is sparse: space is cut into 16x16x16 chunks (64 bricks in Morton order) which are only
+allocated once a cell is placed inside them and are freed again when their last cell dies.
+A directory of chunk pointers covers the bounding box of the tumor and is doubled whenever a
+cell is born outside of it, so there is no fixed ceiling on the size of the tumor and memory
+scales with the volume of the tumor rather than with a worst-case cube.
+Coordinates are signed and the first cell is placed at the origin.
+Each chunk also records the index (in the vector of cells) of the cell at every occupied site, so
+the neighbors of a site can be found without searching, and the number of free sites around it.
+Keeping the free neighbor counts with the lattice (rather than with the cells) means updating the 
+neighbors of a site stays within one or two chunks of memory.
+The index and the count take 5 bytes per site, so a chunk is about 21 KB, of which the occupancy bits
+are 512 bytes. Not every site of a chunk holds a cell: a tumor of 1e6 cells uses about 9 MB of chunks
+without death and 11 MB with a death rate of 0.18, against 16 MB for the vector of cells. A hash table
+from sites to cells would need about 24 bytes per cell (an 8 byte key and the index, half full) and a
+probe for every neighbor that is looked up, so the arrays are kept in the chunks.
+*******************************************************/
+
+#ifndef LATTICE_H_INCLUDED
+#define LATTICE_H_INCLUDED
+
+#include<cstdlib>
+#include<cstring>
+#include<stdint.h>
+#include<vector>
+#include<new>
+
+#define CHUNK_BITS 4
+#define CHUNK_SIDE (1 << CHUNK_BITS)
+#define CHUNK_WORDS 64
+#define CHUNK_SITES (CHUNK_WORDS*64)
+
+struct Chunk {
+    uint64_t words[CHUNK_WORDS];
+    int count;
+    int index[CHUNK_SITES];
+    unsigned char nfree[CHUNK_SITES];
+};
+
+class Lattice {
+public:
+    Lattice() : lo_x(0), lo_y(0), lo_z(0), n_x(0), n_y(0), n_z(0), nchunks(0) {}
+    ~Lattice() {release();}
+
+    void init() {
+        release();
+        //Start with a 4x4x4 block of chunks around the origin
+        resize(-2, -2, -2, 4, 4, 4);
+    }
+
+    void release() {
+        for(size_t i = 0; i < dir.size(); ++i) {
+            free(dir[i]);
+        }
+        std::vector<Chunk*>().swap(dir);
+        n_x = n_y = n_z = 0;
+        nchunks = 0;
+    }
+
+    inline bool occupied(const int x, const int y, const int z) const {
+        const Chunk* chunk = find(x, y, z);
+        if(chunk == NULL) {return false;}
+        return (chunk->words[word(x,y,z)] >> bit(x,y,z)) & 1;
+    }
+
+    //place the cell with the given index at (x,y,z)
+    inline void set(const int x, const int y, const int z, const int index) {
+        Chunk* chunk = find(x, y, z);
+        if(chunk == NULL) {chunk = allocate(x, y, z);}
+        chunk->words[word(x,y,z)] |= (uint64_t)1 << bit(x,y,z);
+        chunk->index[site(x,y,z)] = index;
+        ++chunk->count;
+    }
+
+    //index of the cell at (x,y,z), or -1 if the site is empty
+    inline int index(const int x, const int y, const int z) const {
+        const Chunk* chunk = find(x, y, z);
+        if(chunk == NULL || !((chunk->words[word(x,y,z)] >> bit(x,y,z)) & 1)) {return -1;}
+        return chunk->index[site(x,y,z)];
+    }
+
+    //same as above, and nfree is set to the free neighbor count of the site when it is occupied
+    inline int index(const int x, const int y, const int z, unsigned char* &nfree) {
+        Chunk* chunk = find(x, y, z);
+        if(chunk == NULL || !((chunk->words[word(x,y,z)] >> bit(x,y,z)) & 1)) {return -1;}
+        nfree = &chunk->nfree[site(x,y,z)];
+        return chunk->index[site(x,y,z)];
+    }
+
+    //free neighbor count of the occupied site (x,y,z)
+    inline unsigned char &nfree(const int x, const int y, const int z) {
+        return find(x, y, z)->nfree[site(x,y,z)];
+    }
+
+    //the cell at (x,y,z) has moved to a new index
+    inline void reindex(const int x, const int y, const int z, const int index) {
+        find(x, y, z)->index[site(x,y,z)] = index;
+    }
+
+    inline void clear(const int x, const int y, const int z) {
+        Chunk* &chunk = slot(x >> CHUNK_BITS, y >> CHUNK_BITS, z >> CHUNK_BITS);
+        chunk->words[word(x,y,z)] &= ~((uint64_t)1 << bit(x,y,z));
+        if(--chunk->count == 0) {
+            //no cells left in this chunk
+            free(chunk);
+            chunk = NULL;
+            --nchunks;
+        }
+    }
+
+    //bytes held by the chunks and the directory
+    size_t bytes() const {return nchunks*sizeof(Chunk) + dir.size()*sizeof(Chunk*);}
+
+    //Checkpoints. The directory covers lo[i] <= c < lo[i] + n[i] in chunk coordinates, and its
+    //allocated slots hold the chunks, which are copied as they are
+    void extent(int lo[3], int n[3]) const {
+        lo[0] = lo_x; lo[1] = lo_y; lo[2] = lo_z;
+        n[0] = n_x; n[1] = n_y; n[2] = n_z;
+    }
+
+    size_t slots() const {return dir.size();}
+    size_t chunks() const {return nchunks;}
+    const Chunk* chunk(const size_t slot) const {return dir[slot];}
+
+    //an empty lattice with the given directory
+    void restore(const int lo[3], const int n[3]) {
+        release();
+        resize(lo[0], lo[1], lo[2], n[0], n[1], n[2]);
+    }
+
+    void restore_chunk(const size_t slot, const Chunk &saved) {
+        Chunk* chunk = (Chunk*) malloc(sizeof(Chunk));
+        if(chunk == NULL) {throw std::bad_alloc();}
+        memcpy(chunk, &saved, sizeof(Chunk));
+        dir[slot] = chunk;
+        ++nchunks;
+    }
+
+private:
+    //directory of chunks covering [lo, lo + n) in chunk coordinates along each axis
+    std::vector<Chunk*> dir;
+    int lo_x, lo_y, lo_z;
+    int n_x, n_y, n_z;
+    size_t nchunks;
+
+    //the lattice owns its memory, so it is never copied
+    Lattice(const Lattice&);
+    Lattice& operator=(const Lattice&);
+
+    inline bool inside(const int cx, const int cy, const int cz) const {
+        return (unsigned)(cx - lo_x) < (unsigned)n_x && (unsigned)(cy - lo_y) < (unsigned)n_y
+            && (unsigned)(cz - lo_z) < (unsigned)n_z;
+    }
+
+    inline Chunk* &slot(const int cx, const int cy, const int cz) {
+        return dir[((size_t)(cz - lo_z)*n_y + (cy - lo_y))*n_x + (cx - lo_x)];
+    }
+
+    inline Chunk* find(const int x, const int y, const int z) const {
+        const int cx = x >> CHUNK_BITS, cy = y >> CHUNK_BITS, cz = z >> CHUNK_BITS;
+        if(!inside(cx, cy, cz)) {return NULL;}
+        return dir[((size_t)(cz - lo_z)*n_y + (cy - lo_y))*n_x + (cx - lo_x)];
+    }
+
+    Chunk* allocate(const int x, const int y, const int z) {
+        const int cx = x >> CHUNK_BITS, cy = y >> CHUNK_BITS, cz = z >> CHUNK_BITS;
+        if(!inside(cx, cy, cz)) {
+            //grow the directory to twice its size along every axis that is too small
+            int nlo_x = lo_x, nlo_y = lo_y, nlo_z = lo_z, nn_x = n_x, nn_y = n_y, nn_z = n_z;
+            while(cx < nlo_x || cx >= nlo_x + nn_x) {nlo_x -= nn_x/2; nn_x *= 2;}
+            while(cy < nlo_y || cy >= nlo_y + nn_y) {nlo_y -= nn_y/2; nn_y *= 2;}
+            while(cz < nlo_z || cz >= nlo_z + nn_z) {nlo_z -= nn_z/2; nn_z *= 2;}
+            resize(nlo_x, nlo_y, nlo_z, nn_x, nn_y, nn_z);
+        }
+        Chunk* &chunk = slot(cx, cy, cz);
+        chunk = (Chunk*) malloc(sizeof(Chunk));
+        //not Rcpp::stop, the lattice may be growing on a worker thread
+        if(chunk == NULL) {throw std::bad_alloc();}
+        //only the occupancy bits need to be cleared, the index of a site is written when it is filled
+        memset(chunk->words, 0, sizeof(chunk->words));
+        chunk->count = 0;
+        ++nchunks;
+        return chunk;
+    }
+
+    void resize(const int nlo_x, const int nlo_y, const int nlo_z, const int nn_x, const int nn_y, const int nn_z) {
+        std::vector<Chunk*> ndir((size_t)nn_x*nn_y*nn_z, (Chunk*) NULL);
+        for(int k = 0; k < n_z; ++k) {
+            for(int j = 0; j < n_y; ++j) {
+                for(int i = 0; i < n_x; ++i) {
+                    const int cx = lo_x + i, cy = lo_y + j, cz = lo_z + k;
+                    ndir[((size_t)(cz - nlo_z)*nn_y + (cy - nlo_y))*nn_x + (cx - nlo_x)] =
+                        dir[((size_t)k*n_y + j)*n_x + i];
+                }
+            }
+        }
+        dir.swap(ndir);
+        lo_x = nlo_x; lo_y = nlo_y; lo_z = nlo_z;
+        n_x = nn_x; n_y = nn_y; n_z = nn_z;
+    }
+
+    //brick (Morton order within the chunk) holding the site
+    inline static int word(const int x, const int y, const int z) {
+        const int bx = (x >> 2) & 3, by = (y >> 2) & 3, bz = (z >> 2) & 3;
+        return (bx & 1) | ((by & 1) << 1) | ((bz & 1) << 2) | ((bx & 2) << 2) | ((by & 2) << 3) | ((bz & 2) << 4);
+    }
+
+    //bit of the site within its brick
+    inline static int bit(const int x, const int y, const int z) {
+        return (x & 3) | ((y & 3) << 2) | ((z & 3) << 4);
+    }
+
+    //position of the site within its chunk
+    inline static int site(const int x, const int y, const int z) {
+        return (word(x,y,z) << 6) | bit(x,y,z);
+    }
+};
+
+#endif
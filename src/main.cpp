@@ -1,15 +1,74 @@
 #include"simulations.h"
+#include"sampling.h"
+#include"spatial.h"
+#include"render.h"
 
 // [[Rcpp::export]]
 Rcpp::List simulateTumorcpp(Rcpp::List input) {
-    SimUtils::initIA(input); 
-    Rcpp::List out = Sims::simulateIA(input);
+    SimContext ctx;
+    SimParams params = SimUtils::initIA(ctx, input); 
+    Sims::simulate(ctx, params, false);
+    Rcpp::List out = Sims::write_output(ctx, params, false);
     return out; 
 }
 
 // [[Rcpp::export]] 
 Rcpp::List simulateTumorUDTcpp(Rcpp::List input) {
-    SimUtils::initUDT(input); 
-    Rcpp::List out = Sims::simulateUDT(input);
+    SimContext ctx;
+    SimParams params = SimUtils::initUDT(ctx, input); 
+    Sims::simulate(ctx, params, true);
+    Rcpp::List out = Sims::write_output(ctx, params, true);
     return out; 
-}
\ No newline at end of file
+}
+
+// [[Rcpp::export]] 
+Rcpp::List simulateTumorBatchcpp(Rcpp::List input) {
+    Rcpp::List out = Sims::simulateBatch(input);
+    return out; 
+}
+
+// [[Rcpp::export]] 
+Rcpp::NumericMatrix simulateSummariescpp(Rcpp::List input) {
+    return Sims::simulateSummaries(input);
+}
+// [[Rcpp::export]] 
+Rcpp::List resumeTumorcpp(Rcpp::List input) {
+    SimContext ctx;
+    SimParams params = SimUtils::initResume(ctx, input); 
+    const bool udt = !ctx.G.empty();
+    Sims::simulate(ctx, params, udt);
+    Rcpp::List out = Sims::write_output(ctx, params, udt);
+    //the parameters are not known in R
+    out.push_back(SimUtils::params_vector(params, udt), "params");
+    return out; 
+}
+
+// [[Rcpp::export]] 
+Rcpp::List bulkSamplescpp(Rcpp::List input) {
+    return Sampling::bulk(input);
+}
+
+// [[Rcpp::export]] 
+Rcpp::List singleCellscpp(Rcpp::List input) {
+    return Sampling::single_cells(input);
+}
+
+// [[Rcpp::export]] 
+Rcpp::List jaccardcpp(Rcpp::List input) {
+    return Spatial::jaccard(input);
+}
+
+// [[Rcpp::export]] 
+Rcpp::List radialProfilecpp(Rcpp::List input) {
+    return Spatial::radial(input);
+}
+
+// [[Rcpp::export]] 
+Rcpp::List renderPointscpp(Rcpp::List input) {
+    return Render::surface(input);
+}
+
+// [[Rcpp::export]] 
+Rcpp::List slicescpp(Rcpp::List input) {
+    return Render::slices(input);
+}
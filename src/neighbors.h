@@ -7,85 +7,76 @@ License: GPL-2
 #ifndef NEIGHBORS_H_INCLUDED
 #define NEIGHBORS_H_INCLUDED 
 
-#include"simutils.h"
+#include"context.h"
 
-extern bool*** lattice; 
-extern std::vector<std::vector<int> > perms;
-
-extern int x_dim, y_dim, z_dim;
+//offset of the neighbor specified by key 
+static const int key_dx[7] = {0, 1, -1, 0, 0, 0, 0};
+static const int key_dy[7] = {0, 0, 0, 1, -1, 0, 0};
+static const int key_dz[7] = {0, 0, 0, 0, 0, 1, -1};
 
 //free_neighbor returns true if there is an open space at the neighbor position specified by key
-inline bool free_neighbor(cell cell, bool*** lattice, int key)
+inline bool free_neighbor(const cell &cell, const Lattice &lattice, int key)
 {
     if(key == 1)
     {
-        if(cell.x < x_dim - 1)
+        if(!lattice.occupied(cell.x+1, cell.y, cell.z))
         {
-            if(lattice[cell.x+1][cell.y][cell.z] == 0)
-            {
-                return true;
-            }
+            return true;
         }
     }
     else if(key == 2)
     {
-        if(cell.x > 0)
+        if(!lattice.occupied(cell.x-1, cell.y, cell.z))
         {
-            if(lattice[cell.x-1][cell.y][cell.z] == 0)
-            {
-                return true;
-            }
+            return true;
         }
     }
     else if(key == 3)
     {
-        if(cell.y < y_dim - 1)
+        if(!lattice.occupied(cell.x, cell.y+1, cell.z))
         {
-            if(lattice[cell.x][cell.y+1][cell.z] == 0)
-            {
-                return true;
-            }
+            return true;
         }
     }
     else if(key == 4)
     {
-        if(cell.y > 0)
+        if(!lattice.occupied(cell.x, cell.y-1, cell.z))
         {
-            if(lattice[cell.x][cell.y-1][cell.z] == 0)
-            {
-                return true;
-            }
+            return true;
         }
     }
     else if(key == 5)
     {
-        if(cell.z < z_dim - 1)
+        if(!lattice.occupied(cell.x, cell.y, cell.z+1))
         {
-            if(lattice[cell.x][cell.y][cell.z+1] == 0)
-            {
-                return true;
-            }
+            return true;
         }
     }
     else
     {
-        if(cell.z > 0)
+        if(!lattice.occupied(cell.x, cell.y, cell.z-1))
         {
-            if(lattice[cell.x][cell.y][cell.z-1] == 0)
-            {
-                return true;
-            }
+            return true;
         }
     }
     return false;
 }
 
-inline int random_neighbor(cell cell) {
+//All 720 orderings of the keys 1,...,6. The table is built once and only read afterwards,
+//so it is shared by all simulations
+inline const std::vector<std::vector<int> > &neighbor_perms() {
+    static const int keys[6] = {1, 2, 3, 4, 5, 6};
+    static const std::vector<std::vector<int> > perms = get_perms(std::vector<int>(keys, keys + 6));
+    return perms;
+}
+
+inline int random_neighbor(RandomStream &rng, const Lattice &lattice, const cell &cell) {
     //randomly permute an array of keys
     //std::random_shuffle(nbhd.begin(), nbhd.end(), randWrapper);
     //nbhd = Rcpp::sample(nbhd,6);
     //int ix = floor(unif_rand()*720); 
-    int ix = R::runif(0,720);
+    const std::vector<std::vector<int> > &perms = neighbor_perms();
+    int ix = rng.runif(0,720);
 
     for(int j = 0; j < 6; ++j) {
         if(free_neighbor(cell, lattice, perms[ix][j]) == true) {
@@ -97,32 +88,52 @@ inline int random_neighbor(cell cell) {
     return 0;
 }
 
-//update_lattice puts a 1 in the location where a new cell is born
-inline void update_lattice(cell cell, int key, bool*** lattice)
+//update_lattice places the newborn cell at index on the lattice and updates the free neighbor counts
+//(and birth sampler) of the cells around it 
+inline void update_lattice(SimContext &ctx, const int index)
 {
-    if(key == 1)
-    {
-        lattice[cell.x+1][cell.y][cell.z] = 1;
-    }
-    else if(key == 2)
-    {
-        lattice[cell.x-1][cell.y][cell.z] = 1;
-    }
-    else if(key == 3)
-    {
-        lattice[cell.x][cell.y+1][cell.z] = 1;
-    }
-    else if(key == 4)
-    {
-        lattice[cell.x][cell.y-1][cell.z] = 1;
+    Lattice &lattice = ctx.lattice;
+    cell &cell = ctx.cells[index];
+    lattice.set(cell.x, cell.y, cell.z, index);
+    cell.bucket = -1;
+    //the free neighbor counts are only kept for the channels
+    if(ctx.uniform) {return;}
+
+    unsigned char nfree = 0;
+    unsigned char* nb_free;
+    for(int key = 1; key <= 6; ++key) {
+        int nb = lattice.index(cell.x + key_dx[key], cell.y + key_dy[key], cell.z + key_dz[key], nb_free);
+        if(nb != -1) {
+            if(--(*nb_free) == 0) {
+                remove_boundary(ctx, nb);
+            }
+        } else {
+            ++nfree;
+        }
     }
-    else if(key == 5)
-    {
-        lattice[cell.x][cell.y][cell.z+1] = 1;
+
+    lattice.nfree(cell.x, cell.y, cell.z) = nfree;
+    if(nfree > 0) {
+        add_boundary(ctx, index);
     }
-    else
-    {
-        lattice[cell.x][cell.y][cell.z-1] = 1;
+}
+
+//vacate_lattice removes the cell at index from the lattice and gives a free neighbor back to the cells around it
+inline void vacate_lattice(SimContext &ctx, const int index)
+{
+    Lattice &lattice = ctx.lattice;
+    const cell &cell = ctx.cells[index];
+    lattice.clear(cell.x, cell.y, cell.z);
+    if(ctx.uniform) {return;}
+
+    unsigned char* nb_free;
+    for(int key = 1; key <= 6; ++key) {
+        int nb = lattice.index(cell.x + key_dx[key], cell.y + key_dy[key], cell.z + key_dz[key], nb_free);
+        if(nb != -1) {
+            if((*nb_free)++ == 0) {
+                add_boundary(ctx, nb);
+            }
+        }
     }
 }
 
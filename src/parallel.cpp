@@ -0,0 +1,562 @@
+#include"parallel.h"
+#include<climits>
+
+//the site (x,y,z) is in the first or last plane of the domain, so its neighbors keep a ghost of it
+static inline void log_border(Domain &dom, const int x, const int y, const int z) {
+    if(x == dom.lo || x == dom.hi - 1) {
+        BorderSite site = {(short int)x, (short int)y, (short int)z, false};
+        dom.border.push_back(site);
+    }
+}
+
+//species id, which may be one the domain created in this window and has not been numbered yet
+static inline const specie &get_species(SpeciesRegistry &species, const Domain &dom, const int id) {
+    return id >= 0 ? species[id] : dom.pending[-1 - id].s;
+}
+
+//place a new cell of species id at the site (x,y,z), which belongs to the domain and is empty
+static void place(SpeciesRegistry &species, Domain &dom, const int x, const int y, const int z, const int id) {
+    cell new_cell;
+    new_cell.x = x; new_cell.y = y; new_cell.z = z;
+    new_cell.id = id;
+    new_cell.bucket = -1;
+    const int index = dom.cells.size();
+    dom.cells.push_back(new_cell);
+    dom.lattice.set(x, y, z, index);
+    if(id < 0) {dom.provisional.push_back(index);}
+
+    unsigned char nfree = 0;
+    unsigned char* nb_free;
+    for(int key = 1; key <= 6; ++key) {
+        int nb = dom.lattice.index(x + key_dx[key], y + key_dy[key], z + key_dz[key], nb_free);
+        if(nb >= 0) {
+            if(--(*nb_free) == 0) {
+                dom.birth_sampler.remove(dom.cells, nb);
+            }
+        } else if(nb == -1) {
+            ++nfree;
+        }
+    }
+    dom.lattice.nfree(x, y, z) = nfree;
+    const specie &sp = get_species(species, dom, id);
+    if(nfree > 0) {
+        dom.birth_sampler.insert(dom.cells, index, sp.b);
+    }
+    dom.total_death_rate += sp.d;
+    log_border(dom, x, y, z);
+}
+
+//a site in the halo has been filled
+static void set_ghost(Domain &dom, const int x, const int y, const int z) {
+    dom.lattice.set(x, y, z, GHOST);
+    unsigned char* nb_free;
+    for(int key = 1; key <= 6; ++key) {
+        int nb = dom.lattice.index(x + key_dx[key], y + key_dy[key], z + key_dz[key], nb_free);
+        if(nb >= 0 && --(*nb_free) == 0) {
+            dom.birth_sampler.remove(dom.cells, nb);
+        }
+    }
+}
+
+//a site in the halo has been vacated
+static void clear_ghost(SpeciesRegistry &species, Domain &dom, const int x, const int y, const int z) {
+    dom.lattice.clear(x, y, z);
+    unsigned char* nb_free;
+    for(int key = 1; key <= 6; ++key) {
+        int nb = dom.lattice.index(x + key_dx[key], y + key_dy[key], z + key_dz[key], nb_free);
+        if(nb >= 0 && (*nb_free)++ == 0) {
+            dom.birth_sampler.insert(dom.cells, nb, species[dom.cells[nb].id].b);
+        }
+    }
+}
+
+static void kill_cell(SpeciesRegistry &species, Domain &dom, const int index) {
+    std::vector<cell> &cells = dom.cells;
+    const cell dead = cells[index];
+
+    dom.birth_sampler.remove(cells, index);
+    dom.lattice.clear(dead.x, dead.y, dead.z);
+    unsigned char* nb_free;
+    for(int key = 1; key <= 6; ++key) {
+        int nb = dom.lattice.index(dead.x + key_dx[key], dead.y + key_dy[key], dead.z + key_dz[key], nb_free);
+        if(nb >= 0 && (*nb_free)++ == 0) {
+            dom.birth_sampler.insert(cells, nb, get_species(species, dom, cells[nb].id).b);
+        }
+    }
+    dom.total_death_rate -= get_species(species, dom, dead.id).d;
+
+    //the last cell takes its place
+    int last = cells.size() - 1;
+    if(index != last) {
+        cells[index] = cells[last];
+        dom.lattice.reindex(cells[index].x, cells[index].y, cells[index].z, index);
+        dom.birth_sampler.move(cells, index);
+        if(cells[index].id < 0) {dom.provisional.push_back(index);}
+    }
+    cells.pop_back();
+    log_border(dom, dead.x, dead.y, dead.z);
+}
+
+static double drift_color(RandomStream &rng, const double color) {
+    double c = color + rng.rnorm(0,0.05);
+    if(c > 1) {
+        c = 1-rng.rnorm(0,0.05);
+    } else if(c < 0) {
+        c = std::abs(rng.rnorm(0,0.05));
+    }
+    return c;
+}
+
+//a new species with nmuts mutations on top of the parent species, as in birth_cellIA. It is held by the
+//domain until the end of the window, and the provisional id is returned
+static int new_species(SpeciesRegistry &species, const SimParams &p, Domain &dom, const int parent, const int nmuts) {
+    RandomStream &rng = dom.rng;
+    NewSpecies pending;
+    specie &new_species = pending.s;
+    const specie &parent_species = get_species(species, dom, parent);
+    new_species.parent = parent;
+    new_species.count = 0;
+
+    double br = parent_species.b;
+    std::vector<bool> &driver = pending.driver;
+    driver.assign(nmuts, false);
+    for(int i = 0; i < nmuts; ++i) {
+        if(rng.rbern(p.du) == 1) {
+            //apply multiplicative update
+            br *= p.s;
+            driver[i] = true;
+        }
+    }
+    new_species.b = br;
+    new_species.d = p.wt_dr;
+    new_species.nmuts = parent_species.nmuts + nmuts;
+
+    const bool resistant = rng.rbern(p.tr) == 1;
+    new_species.treatment_resistance = parent_species.treatment_resistance || resistant;
+
+    new_species.red = drift_color(rng, parent_species.red);
+    new_species.green = drift_color(rng, parent_species.green);
+    new_species.blue = drift_color(rng, parent_species.blue);
+
+    //the parent must not be read after this, pending may move
+    dom.pending.push_back(pending);
+    return -(int)dom.pending.size();
+}
+
+//number the species the domains created in this window, domain after domain, and give the final ids to the
+//daughters sent to other domains. A species comes after its parent, which was numbered before the window
+//or earlier in the same domain
+static void number_species(SimContext &ctx, SpeciesRegistry &species, std::vector<Domain> &doms, const int used) {
+    for(int k = 0; k < used; ++k) {
+        Domain &dom = doms[k];
+        dom.numbered.resize(dom.pending.size());
+        for(size_t j = 0; j < dom.pending.size(); ++j) {
+            specie &s = dom.pending[j].s;
+            const std::vector<bool> &driver = dom.pending[j].driver;
+            if(s.parent < 0) {s.parent = dom.numbered[-1 - s.parent];}
+            const int nmuts = driver.size();
+
+            //the mutations of a division follow each other in the phylogenetic tree
+            int previous = species[s.parent].genotype.back();
+            s.genotype.reserve(nmuts);
+            for(int i = 0; i < nmuts; ++i) {
+                ++ctx.total_mutations;
+                s.genotype.push_back(ctx.total_mutations);
+                ctx.phylo_tree[0].push_back(previous);
+                ctx.phylo_tree[1].push_back(ctx.total_mutations);
+                previous = ctx.total_mutations;
+                if(driver[i]) {
+                    ctx.drivers.push_back(ctx.total_mutations);
+                }
+            }
+            s.id = species.size();
+            dom.numbered[j] = s.id;
+            species.push_back(s);
+        }
+        for(size_t i = 0; i < dom.outbox.size(); ++i) {
+            int &id = dom.outbox[i].id;
+            if(id < 0) {id = dom.numbered[-1 - id];}
+        }
+    }
+}
+
+//give the final ids to the cells of the domain which hold a species created in this window
+static void renumber_cells(Domain &dom) {
+    for(size_t i = 0; i < dom.provisional.size(); ++i) {
+        const int index = dom.provisional[i];
+        //the cell may have died, or its index been taken by another cell
+        if(index < (int)dom.cells.size() && dom.cells[index].id < 0) {
+            dom.cells[index].id = dom.numbered[-1 - dom.cells[index].id];
+        }
+    }
+    dom.pending.clear();
+    dom.provisional.clear();
+}
+
+static void birth(SpeciesRegistry &species, const SimParams &p, Domain &dom) {
+    std::vector<cell> &cells = dom.cells;
+
+    //The chosen cell is on the boundary so it has at least one free neighbor (or ghost)
+    const int index = dom.birth_sampler.sample(dom.rng);
+    const int key = random_neighbor(dom.rng, dom.lattice, cells[index]);
+    const int parent = cells[index].id;
+    const int x = cells[index].x + key_dx[key];
+    const int y = cells[index].y + key_dy[key];
+    const int z = cells[index].z + key_dz[key];
+
+    //daughter cell
+    int nmuts = dom.rng.rpois(p.u);
+    const int daughter = nmuts > 0 ? new_species(species, p, dom, parent, nmuts) : parent;
+
+    //original cell may mutate as well
+    nmuts = dom.rng.rpois(p.u);
+    if(nmuts > 0) {
+        const int id = new_species(species, p, dom, parent, nmuts);
+        cells[index].id = id;
+        dom.provisional.push_back(index);
+        const specie &sp = get_species(species, dom, id);
+        if(cells[index].bucket != -1) {
+            dom.birth_sampler.remove(cells, index);
+            dom.birth_sampler.insert(cells, index, sp.b);
+        }
+        dom.total_death_rate += sp.d - get_species(species, dom, parent).d;
+    }
+
+    if(x >= dom.lo && x < dom.hi) {
+        place(species, dom, x, y, z, daughter);
+    } else {
+        //the site belongs to the next domain, hold it until the end of the window
+        cell new_cell;
+        new_cell.x = x; new_cell.y = y; new_cell.z = z;
+        new_cell.id = daughter;
+        dom.outbox.push_back(new_cell);
+        set_ghost(dom, x, y, z);
+    }
+}
+
+static void run_window(const SimContext &ctx, SpeciesRegistry &species, const SimParams &p, Domain &dom,
+                    const double start, const double end) {
+    //the neighbors have read the lists of the last window
+    dom.outbox.clear();
+    dom.border.clear();
+    double time = start;
+    while(true) {
+        const double total_rate = dom.birth_sampler.total() + dom.total_death_rate;
+        if(dom.cells.empty() || total_rate <= 0) {break;}
+        time += dom.rng.rexp(1/total_rate);
+        if(time > end) {break;}
+        ++dom.stats.events;
+
+        if(dom.rng.runif(0, total_rate) < dom.birth_sampler.total()) {
+            birth(species, p, dom);
+            ++dom.births;
+            ++dom.stats.births;
+        } else {
+            //Death, by rejection against d_max as in selectDeathIndex
+            int index;
+            while(true) {
+                ++dom.stats.death_draws;
+                index = dom.rng.runif(0, dom.cells.size());
+                if(dom.rng.runif(0, ctx.d_max) < get_species(species, dom, dom.cells[index].id).d) {break;}
+            }
+            //as in the serial engine, a domain always keeps one cell
+            if(dom.cells.size() > 1) {
+                kill_cell(species, dom, index);
+                ++dom.stats.deaths;
+            } else {
+                ++dom.stats.skipped_deaths;
+            }
+        }
+    }
+}
+
+//place the daughters the neighboring domains sent into this one
+static void receive(SpeciesRegistry &species, Domain &dom, const Domain &from) {
+    for(size_t i = 0; i < from.outbox.size(); ++i) {
+        const cell &c = from.outbox[i];
+        if(c.x < dom.lo || c.x >= dom.hi) {continue;}
+        if(dom.lattice.occupied(c.x, c.y, c.z)) {
+            //the site was filled from this side during the window
+            ++dom.stats.dropped_daughters;
+        } else {
+            place(species, dom, c.x, c.y, c.z, c.id);
+        }
+    }
+}
+
+//bring the halo in line with the sites the neighboring domain changed
+static void update_halo(SpeciesRegistry &species, Domain &dom, const Domain &from) {
+    for(size_t i = 0; i < from.border.size(); ++i) {
+        const BorderSite &site = from.border[i];
+        if(site.x != dom.lo - 1 && site.x != dom.hi) {continue;}
+        const bool ghost = dom.lattice.occupied(site.x, site.y, site.z);
+        if(site.occupied && !ghost) {
+            set_ghost(dom, site.x, site.y, site.z);
+        } else if(!site.occupied && ghost) {
+            clear_ghost(species, dom, site.x, site.y, site.z);
+        }
+    }
+}
+
+//one step of a window for domain k, every step finishes for all domains before the next one starts.
+//The new species are numbered between steps 0 and 1
+static void window_step(const int step, SimContext &ctx, SpeciesRegistry &species, const SimParams &p,
+                    std::vector<Domain> &doms, const int used, const int k, const double start, const double end) {
+    Domain &dom = doms[k];
+    switch(step) {
+        case 0:
+            run_window(ctx, species, p, dom, start, end);
+            break;
+        case 1:
+            renumber_cells(dom);
+            if(k > 0) {receive(species, dom, doms[k - 1]);}
+            if(k < used - 1) {receive(species, dom, doms[k + 1]);}
+            break;
+        case 2:
+            for(size_t i = 0; i < dom.border.size(); ++i) {
+                BorderSite &site = dom.border[i];
+                site.occupied = dom.lattice.occupied(site.x, site.y, site.z);
+            }
+            break;
+        case 3:
+            if(k > 0) {update_halo(species, dom, doms[k - 1]);}
+            if(k < used - 1) {update_halo(species, dom, doms[k + 1]);}
+            break;
+    }
+}
+
+//set up the lattice and event channels of a domain from its cells and the ghosts around it
+static void init_domain(SpeciesRegistry &species, Domain &dom, const std::vector<cell> &ghosts) {
+    dom.lattice.init();
+    dom.birth_sampler.clear();
+    dom.total_death_rate = 0;
+    for(size_t i = 0; i < dom.cells.size(); ++i) {
+        const cell &c = dom.cells[i];
+        dom.lattice.set(c.x, c.y, c.z, i);
+    }
+    for(size_t i = 0; i < ghosts.size(); ++i) {
+        dom.lattice.set(ghosts[i].x, ghosts[i].y, ghosts[i].z, GHOST);
+    }
+    for(size_t i = 0; i < dom.cells.size(); ++i) {
+        cell &c = dom.cells[i];
+        unsigned char nfree = 0;
+        for(int key = 1; key <= 6; ++key) {
+            if(free_neighbor(c, dom.lattice, key)) {++nfree;}
+        }
+        dom.lattice.nfree(c.x, c.y, c.z) = nfree;
+        c.bucket = -1;
+        if(nfree > 0) {
+            dom.birth_sampler.insert(dom.cells, i, species[c.id].b);
+        }
+        dom.total_death_rate += species[c.id].d;
+    }
+}
+
+//cut the tumor in ctx into slabs along x with about the same number of cells, returns the number of slabs
+static int split(SimContext &ctx, SpeciesRegistry &species, std::vector<Domain> &doms) {
+    std::vector<cell> &cells = ctx.cells;
+    const int ndoms = doms.size();
+
+    int xmin = INT_MAX, xmax = INT_MIN;
+    for(size_t i = 0; i < cells.size(); ++i) {
+        xmin = std::min(xmin, (int)cells[i].x);
+        xmax = std::max(xmax, (int)cells[i].x);
+    }
+    std::vector<int> plane(xmax - xmin + 1, 0);
+    for(size_t i = 0; i < cells.size(); ++i) {
+        ++plane[cells[i].x - xmin];
+    }
+
+    //domain d ends after the plane where the running total passes (d+1)/ndoms of the cells
+    std::vector<int> owner(plane.size());
+    const int nplanes = plane.size();
+    int d = 0;
+    double total = 0;
+    for(int i = 0; i < nplanes; ++i) {
+        owner[i] = d;
+        total += plane[i];
+        if(d < ndoms - 1 && total >= (double)(d + 1)*cells.size()/ndoms && i < nplanes - 1) {
+            doms[d].hi = xmin + i + 1;
+            ++d;
+            doms[d].lo = xmin + i + 1;
+        }
+    }
+    const int used = d + 1;
+    //coordinates are short ints, so the outer domains extend past any site
+    doms[0].lo = SHRT_MIN - 2;
+    doms[used - 1].hi = SHRT_MAX + 2;
+
+    //cells of each domain, and the cells on its borders that the neighbors keep as ghosts
+    std::vector<std::vector<cell> > ghosts(used);
+    for(size_t i = 0; i < cells.size(); ++i) {
+        const int k = owner[cells[i].x - xmin];
+        doms[k].cells.push_back(cells[i]);
+        if(k > 0 && cells[i].x == doms[k].lo) {ghosts[k - 1].push_back(cells[i]);}
+        if(k < used - 1 && cells[i].x == doms[k].hi - 1) {ghosts[k + 1].push_back(cells[i]);}
+    }
+    std::vector<cell>().swap(cells);
+    ctx.lattice.release();
+    ctx.stats.add_sampler(ctx.birth_sampler);
+    ctx.birth_sampler.clear();
+    species.take(ctx.species);
+
+    for(int k = 0; k < used; ++k) {
+        ctx.rng.split(doms[k].rng);
+        doms[k].births = 0;
+        doms[k].stats.clear();
+    }
+
+    std::vector<std::string> errors(used);
+    #pragma omp parallel for schedule(dynamic) num_threads(used)
+    for(int k = 0; k < used; ++k) {
+        try {
+            init_domain(species, doms[k], ghosts[k]);
+        } catch(std::exception &e) {
+            errors[k] = e.what();
+        } catch(...) {
+            errors[k] = "unknown error";
+        }
+    }
+    for(int k = 0; k < used; ++k) {
+        if(!errors[k].empty()) {Rcpp::stop(errors[k]);}
+    }
+    return used;
+}
+
+//put the domains back together into ctx
+static void merge(SimContext &ctx, SpeciesRegistry &species, std::vector<Domain> &doms, const int used) {
+    std::vector<cell> &cells = ctx.cells;
+    size_t total = 0;
+    double lattice_bytes = 0, cell_bytes = 0;
+    for(int k = 0; k < used; ++k) {
+        total += doms[k].cells.size();
+        lattice_bytes += doms[k].lattice.bytes();
+        cell_bytes += doms[k].cells.capacity()*sizeof(cell);
+    }
+    //the species are measured at the end of the phase
+    ctx.stats.note_memory(lattice_bytes, cell_bytes, 0);
+    cells.reserve(total);
+    for(int k = 0; k < used; ++k) {
+        cells.insert(cells.end(), doms[k].cells.begin(), doms[k].cells.end());
+        std::vector<cell>().swap(doms[k].cells);
+        doms[k].lattice.release();
+        ctx.stats.add_counts(doms[k].stats);
+        ctx.stats.add_sampler(doms[k].birth_sampler);
+        doms[k].birth_sampler.clear();
+    }
+    species.give(ctx.species);
+
+    //recount the species
+    for(size_t i = 0; i < ctx.species.size(); ++i) {ctx.species[i].count = 0;}
+    for(size_t i = 0; i < cells.size(); ++i) {++ctx.species[cells[i].id].count;}
+
+    //rebuild the lattice and the event channels
+    ctx.lattice.init();
+    for(size_t i = 0; i < cells.size(); ++i) {
+        ctx.lattice.set(cells[i].x, cells[i].y, cells[i].z, i);
+    }
+    SimUtils::rebuild_channels(ctx, used);
+}
+
+void Parallel::growIA(SimContext &ctx, const SimParams &p, const int target, const double until,
+                      Checkpointer &checkpoints, Progress &progress) {
+    const int n = ctx.cells.size();
+    if(p.nthreads < 2 || n < PARALLEL_MIN_CELLS*p.nthreads || n >= target || ctx.time >= until || !ctx.stopped.empty()) {return;}
+    SpeciesRegistry species;
+    double windows = 0, events = 0, births = 0, dropped = 0;
+    bool done = false;
+
+    while(!done) {
+        //split the tumor, and split it again once it has doubled
+        const int start_size = ctx.cells.size();
+        std::vector<Domain> doms(p.nthreads);
+        const int used = split(ctx, species, doms);
+        if(p.verbose) {
+            Rcpp::Rcout << "Growing from " << start_size << " cells on " << used << " domains ... ...\n";
+        }
+
+        int population = start_size;
+        while(true) {
+            //stop while the serial engine can still reach the target without overshooting,
+            //the tumor can not grow by more than the births in a window
+            if(population + 2*births >= target || ctx.time >= until) {done = true; break;}
+            if(population >= 2*start_size) {break;}
+
+            double max_rate = 0;
+            for(int k = 0; k < used; ++k) {
+                max_rate = std::max(max_rate, doms[k].birth_sampler.max_rate());
+            }
+            const double start = ctx.time;
+            //the last window ends at until, so a dose due then is given on time
+            const double end = std::min(until, start + WINDOW_EVENTS/(max_rate + ctx.d_max));
+
+            std::vector<std::string> errors(used);
+            for(int phase = 0; phase < 2; ++phase) {
+                #pragma omp parallel num_threads(used)
+                for(int step = phase == 0 ? 0 : 1; step < (phase == 0 ? 1 : 4); ++step) {
+                    #pragma omp for schedule(dynamic)
+                    for(int k = 0; k < used; ++k) {
+                        //exceptions can not leave the parallel region, so they are reported after it
+                        try {
+                            window_step(step, ctx, species, p, doms, used, k, start, end);
+                        } catch(std::exception &e) {
+                            errors[k] = e.what();
+                        } catch(...) {
+                            errors[k] = "unknown error";
+                        }
+                    }
+                }
+                for(int k = 0; k < used; ++k) {
+                    if(!errors[k].empty()) {Rcpp::stop(errors[k]);}
+                }
+                if(phase == 0) {number_species(ctx, species, doms, used);}
+            }
+
+            ctx.time = end;
+            ++windows;
+            population = 0;
+            births = 0;
+            double window_events = ctx.stats.events;
+            for(int k = 0; k < used; ++k) {
+                population += doms[k].cells.size();
+                births += doms[k].births;
+                doms[k].births = 0;
+                window_events += doms[k].stats.events;
+            }
+
+            const bool record = ctx.history.due(ctx.time, population);
+            if(record || ctx.stop_rule.counts()) {
+                //species counts are not kept while the tumor is split
+                for(int i = 0; i < species.size(); ++i) {species[i].count = 0;}
+                for(int k = 0; k < used; ++k) {
+                    for(size_t i = 0; i < doms[k].cells.size(); ++i) {++species[doms[k].cells[i].id].count;}
+                }
+                ctx.stop_rule.reset(species, species.size());
+            }
+            if(record) {
+                ctx.history.record(ctx.time, population, species, species.size(), ctx.drivers);
+            }
+            if(ctx.stop_rule.active()) {
+                ctx.stop_rule.check(ctx.time, population, ctx.drivers.size(), species, ctx.stopped);
+            }
+
+            //a stopped run is put back together and returned as it is
+            if(ctx.stopped.empty()) {progress.poll(ctx, population, window_events, target);}
+            if(!ctx.stopped.empty()) {done = true; break;}
+        }
+
+        for(int k = 0; k < used; ++k) {
+            events += doms[k].stats.events;
+            dropped += doms[k].stats.dropped_daughters;
+        }
+        merge(ctx, species, doms, used);
+        ctx.stop_rule.reset(ctx.species, ctx.species.size());
+        if(p.verbose) {Rcpp::Rcout << "Simulated time: " << ctx.time << " days. Population is " << ctx.cells.size() << " cells. \n";}
+        checkpoints.poll(ctx, p);
+    }
+
+    if(p.verbose) {
+        Rcpp::Rcout << "Parallel growth: " << events << " events in " << windows << " windows, "
+                    << dropped << " daughters dropped at domain borders. \n";
+    }
+}
@@ -0,0 +1,159 @@
+/*
+SITH: An R package for visualizing and analyzing a spatial model of intra-tumor heterogeneity
+Author: Phillip Nicol
+License: GPL-2
+*/
+
+/***********************************************************
+Parallel growth of a single tumor by domain decomposition (infinite alleles only).
+Space is cut into slabs along the x axis with about as many cells in each, one slab per thread.
+A slab (a Domain) owns the sites and cells inside it, and keeps its own lattice, birth sampler,
+death rate and random number stream. Its lattice also holds ghost copies of the sites in the two
+planes just outside of it (the halo), so cells on the border see the cells of the next slab.
+
+Time advances in short windows. Within a window every domain runs the usual two channel Gillespie
+algorithm on its own cells, independently of the other domains. Waiting times are exponential,
+so a domain can stop at the end of the window and start again from there without bias.
+A daughter cell placed in the halo is sent to the owner of the site at the end of the window, and
+is dropped if the owner has filled the site in the meantime. Each domain also lists the sites on
+its border that changed, and its neighbors update their halos from these lists.
+Cells therefore learn about the other side of a border one window late. The window is chosen so
+that a cell has about a 5% chance of an event within it, and the tumor agrees with the serial
+engine in distribution (up to this delay), not draw for draw.
+
+A domain keeps the species it creates within a window to itself, under provisional ids (-1 for its
+first new species, -2 for the next, ...), with the cells that hold them listed by index. At the end of
+the window the new species and their mutations are numbered on one thread, domain after domain, and
+the listed cells and the daughters in the outboxes are given the final ids. The numbering does not
+depend on the order the threads ran in, so a seed and a number of threads always give the same tumor,
+and a species is still numbered after its parent (a daughter only changes domain at the end of a window).
+The species live in a registry whose storage never moves, so the threads read them without locking.
+Species counts are not kept during the parallel phase and are recounted from the cells at the end.
+The tumor is merged and split again whenever it has doubled, which keeps the slabs balanced,
+and the serial engine takes over for the last windows so the tumor ends at exactly the target size.
+*******************************************************/
+
+#ifndef PARALLEL_H_INCLUDED
+#define PARALLEL_H_INCLUDED
+
+#include<stdexcept>
+#include"context.h"
+#include"neighbors.h"
+#include"checkpoint.h"
+#include"progress.h"
+
+//cells per thread before the tumor is split
+#define PARALLEL_MIN_CELLS 4096
+//expected number of events per cell within a window
+#define WINDOW_EVENTS 0.05
+
+//lattice index of a ghost site (a site in the halo, owned by a neighboring domain)
+#define GHOST -2
+
+//species are stored in blocks of 2^SPECIES_BLOCK_BITS
+#define SPECIES_BLOCK_BITS 12
+#define SPECIES_BLOCK (1 << SPECIES_BLOCK_BITS)
+#define SPECIES_MAX_BLOCKS (1 << 18)
+
+class SpeciesRegistry {
+public:
+    SpeciesRegistry() : n(0), blocks(SPECIES_MAX_BLOCKS, (specie*) NULL) {}
+    ~SpeciesRegistry() {clear();}
+
+    //take over the species of a simulation
+    void take(std::vector<specie> &species) {
+        clear();
+        for(int i = 0; i < species.size(); ++i) {
+            push_back(species[i]);
+        }
+        std::vector<specie>().swap(species);
+    }
+
+    //give the species back to the simulation
+    void give(std::vector<specie> &species) {
+        species.resize(n);
+        for(int i = 0; i < n; ++i) {
+            std::swap(species[i], (*this)[i]);
+        }
+        clear();
+    }
+
+    inline specie &operator[](const int id) {
+        return blocks[id >> SPECIES_BLOCK_BITS][id & (SPECIES_BLOCK - 1)];
+    }
+
+    //species are added on one thread, between two windows (s is moved into the registry)
+    int push_back(specie &s) {
+        if(n == SPECIES_BLOCK*SPECIES_MAX_BLOCKS) {throw std::length_error("Too many species.");}
+        specie* &block = blocks[n >> SPECIES_BLOCK_BITS];
+        if(block == NULL) {block = new specie[SPECIES_BLOCK]();}
+        std::swap(block[n & (SPECIES_BLOCK - 1)], s);
+        return n++;
+    }
+
+    int size() const {return n;}
+
+private:
+    int n;
+    //the table of blocks is never resized, so reading a species never races with adding one
+    std::vector<specie*> blocks;
+
+    void clear() {
+        for(size_t i = 0; i < blocks.size(); ++i) {
+            delete[] blocks[i];
+            blocks[i] = NULL;
+        }
+        n = 0;
+    }
+
+    SpeciesRegistry(const SpeciesRegistry&);
+    SpeciesRegistry& operator=(const SpeciesRegistry&);
+};
+
+//a species created by a domain within a window, before it is numbered. Its genotype is empty, and
+//driver tells which of its mutations are drivers
+struct NewSpecies {
+    specie s;
+    std::vector<bool> driver;
+};
+
+//a site on the border of a domain, and whether it is occupied at the end of the window
+struct BorderSite {
+    short int x,y,z;
+    bool occupied;
+};
+
+struct Domain {
+    std::vector<cell> cells;
+    Lattice lattice;
+    RateSampler birth_sampler;
+    double total_death_rate;
+    RandomStream rng;
+
+    //the domain owns the sites with lo <= x < hi
+    int lo, hi;
+
+    //daughters born into the halo, to be placed by the neighboring domain
+    std::vector<cell> outbox;
+    //sites in the first and last plane of the domain that changed in this window
+    std::vector<BorderSite> border;
+    //species created in this window, the indices of the cells that may hold them (some may be out of
+    //date), and the final ids of the species once they are numbered
+    std::vector<NewSpecies> pending;
+    std::vector<int> provisional;
+    std::vector<int> numbered;
+
+    //births in the current window, and the counters of the domain since the last split
+    int births;
+    RunStats stats;
+};
+
+namespace Parallel {
+    //grow the tumor in ctx with p.nthreads threads until it is within a few windows of target cells, or the
+    //simulated time reaches until (snapshots are only written in between two splits of the tumor, and progress
+    //and the stop rule are checked after every window)
+    void growIA(SimContext &ctx, const SimParams &p, const int target, const double until,
+                Checkpointer &checkpoints, Progress &progress);
+}
+
+#endif
@@ -1,35 +1,123 @@
 #include"postproc.h" 
 
 
-void PostProcessing::write_results(std::vector<cell> &cells, std::vector<specie> &species, 
-                                    Rcpp::NumericMatrix &cell_coords, Rcpp::IntegerMatrix &species_dict, Rcpp::IntegerVector &muts) {
-    for(int i = 0; i < cells.size(); ++i) {
-        cell_coords(i, 0) = cells[i].x - x_dim/2;
-        cell_coords(i, 1) = cells[i].y - y_dim/2;
-        cell_coords(i, 2) = cells[i].z - z_dim/2;
-        cell_coords(i, 3) = cells[i].id;
-        cell_coords(i, 4) = species[cells[i].id].genotype.size(); 
-        cell_coords(i, 5) = sqrt(cell_coords(i,0)*cell_coords(i,0) + cell_coords(i,1)*cell_coords(i,1) + cell_coords(i,2)*cell_coords(i,2));
-        if(species[cells[i].id].treatment_resistance) {
-            cell_coords(i,6) = 1;
-        } else {
-            cell_coords(i,6) = 0;
+Rcpp::List PostProcessing::write_results(const std::vector<cell> &cells, const std::vector<specie> &species, 
+                                         const int nthreads) {
+    const int n = cells.size();
+    Rcpp::IntegerVector x(n), y(n), z(n), genotype(n), nmuts(n), resistant(n);
+    Rcpp::NumericVector distance(n);
+
+    //the columns are filled through plain pointers, so the threads never touch R
+    int *px = x.begin(), *py = y.begin(), *pz = z.begin();
+    int *pg = genotype.begin(), *pm = nmuts.begin(), *pr = resistant.begin();
+    double *pd = distance.begin();
+    #pragma omp parallel for schedule(static) num_threads(nthreads)
+    for(int i = 0; i < n; ++i) {
+        const cell &c = cells[i];
+        const specie &sp = species[c.id];
+        px[i] = c.x; py[i] = c.y; pz[i] = c.z;
+        pg[i] = c.id;
+        pm[i] = sp.nmuts;
+        pd[i] = sqrt((double)(c.x*c.x + c.y*c.y + c.z*c.z));
+        pr[i] = sp.treatment_resistance ? 1 : 0;
+    }
+
+    //a data frame without the copy made by data.frame() in R
+    Rcpp::List out = Rcpp::List::create();
+    out.push_back(x, "x");
+    out.push_back(y, "y");
+    out.push_back(z, "z");
+    out.push_back(genotype, "genotype");
+    out.push_back(nmuts, "nmuts");
+    out.push_back(distance, "distance");
+    out.push_back(resistant, "resistant");
+    out.attr("class") = "data.frame";
+    out.attr("row.names") = Rcpp::IntegerVector::create(NA_INTEGER, -n);
+    return out;
+}
+
+void PostProcessing::count_mutations(const std::vector<specie> &species, int *muts, const int nthreads) {
+    //A mutation is carried by every cell in the subtree of the specie that gained it. Going from the
+    //youngest specie to the oldest, each specie adds its subtree total to its parent
+    const int nspecies = species.size();
+    std::vector<int> total(nspecies, 0);
+    for(int i = nspecies - 1; i >= 0; --i) {
+        total[i] += species[i].count;
+        if(species[i].parent != -1) {
+            total[species[i].parent] += total[i];
         }
-    }    
+    }
 
-    //Write species results
-    int nmuts;
+    //Then every specie adds its subtree total to its mutations. Under infinite alleles a mutation
+    //belongs to a single specie, under a disease model the states are shared by many species
+    int *pm = muts;
+    #pragma omp parallel for schedule(static) num_threads(nthreads)
+    for(int i = 0; i < nspecies; ++i) {
+        const std::vector<int> &genotype = species[i].genotype;
+        for(int j = 0; j < genotype.size(); ++j) {
+            #pragma omp atomic
+            pm[genotype[j]] += total[i];
+        }
+    }
+}
+
+void PostProcessing::write_species_dict(std::vector<specie> &species, Rcpp::IntegerMatrix &species_dict) {
+    //A specie is always created after its parent, so the row of the parent has already been written
+    //and the genotype of the specie is that row followed by its own mutations
     for(int i = 0; i < species.size(); ++i) {
-        nmuts = species[i].count;
+        int start = 0;
+        if(species[i].parent != -1) {
+            start = species[species[i].parent].nmuts;
+            for(int j = 0; j < start; ++j) {
+                species_dict(i, j) = species_dict(species[i].parent, j);
+            }
+        }
         for(int j = 0; j < species[i].genotype.size(); ++j) {
-            species_dict(i, j) = species[i].genotype[j];
-            muts[species[i].genotype[j]] += nmuts;
+            species_dict(i, start + j) = species[i].genotype[j];
         }
-        for(int j = species[i].genotype.size(); j < species_dict.ncol() - 1; ++j) {
+        for(int j = species[i].nmuts; j < species_dict.ncol() - 1; ++j) {
             species_dict(i, j) = -1;
         }
-        species_dict(i, species_dict.ncol() - 1) = nmuts;
+        species_dict(i, species_dict.ncol() - 1) = species[i].count;
+    }
+}
+
+Rcpp::List PostProcessing::write_species_csr(std::vector<specie> &species) {
+    //The mutations of specie i are mutations[offsets[i], offsets[i+1]) (0-based)
+    Rcpp::IntegerVector offsets(species.size() + 1);
+    Rcpp::IntegerVector counts(species.size());
+    double total = 0;
+    for(int i = 0; i < species.size(); ++i) {
+        total += species[i].nmuts;
+    }
+    if(total > INT_MAX) {Rcpp::stop("Too many mutations to export the genotypes.");}
+
+    offsets[0] = 0;
+    for(int i = 0; i < species.size(); ++i) {
+        offsets[i+1] = offsets[i] + species[i].nmuts;
+        counts[i] = species[i].count;
+    }
+
+    //As with the dense export, the parent's mutations are copied from where they were already written
+    Rcpp::IntegerVector mutations((int) total);
+    for(int i = 0; i < species.size(); ++i) {
+        int pos = offsets[i];
+        if(species[i].parent != -1) {
+            const int p = species[i].parent;
+            for(int j = offsets[p]; j < offsets[p+1]; ++j) {
+                mutations[pos++] = mutations[j];
+            }
+        }
+        for(int j = 0; j < species[i].genotype.size(); ++j) {
+            mutations[pos++] = species[i].genotype[j];
+        }
     }
+
+    Rcpp::List csr = Rcpp::List::create();
+    csr.push_back(offsets, "offsets");
+    csr.push_back(mutations, "mutations");
+    csr.push_back(counts, "count");
+    return csr;
 }
 
 void PostProcessing::write_phylo_tree(std::vector<std::vector<int> > &phylo_tree, Rcpp::IntegerMatrix &rphylo_tree) {
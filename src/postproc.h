@@ -2,14 +2,18 @@
 #define POSTPROC_H
 
 #include"simutils.h"
+#include<climits>
 
-extern int x_dim, y_dim, z_dim; 
 #define rgb_lb 0.09
 #define rgb_ub 0.91
 
 namespace PostProcessing {
-    void write_results(std::vector<cell> &cells, std::vector<specie> &species, 
-                    Rcpp::NumericMatrix &cell_coords, Rcpp::IntegerMatrix &species_dict, Rcpp::IntegerVector &muts);
+    //the cells as the columns of a data frame, filled on nthreads threads
+    Rcpp::List write_results(const std::vector<cell> &cells, const std::vector<specie> &species, const int nthreads);
+    //number of cells carrying each mutation, added to muts (which has one entry per mutation)
+    void count_mutations(const std::vector<specie> &species, int *muts, const int nthreads);
+    void write_species_dict(std::vector<specie> &species, Rcpp::IntegerMatrix &species_dict);
+    Rcpp::List write_species_csr(std::vector<specie> &species);
     void write_phylo_tree(std::vector<std::vector<int> > &phylo_tree, Rcpp::IntegerMatrix &rphylo_tree);
     Rcpp::NumericMatrix get_color_scheme(std::vector<specie> &species);
 }
@@ -0,0 +1,59 @@
+#include"progress.h"
+
+static void check_interrupt(void*) {
+    R_CheckUserInterrupt();
+}
+
+//whether the user has asked R to interrupt, without jumping out of the engine
+static bool interrupt_pending() {
+    return R_ToplevelExec(check_interrupt, NULL) == FALSE;
+}
+
+Progress::Progress(const SimContext &ctx, const SimParams &p) : p(p), countdown(POLL_EVENTS) {
+    start = wall_seconds();
+    last = start;
+    last_population = ctx.cells.size();
+    last_events = ctx.stats.events;
+}
+
+void Progress::poll(SimContext &ctx, const double population, const double events, const double target) {
+    const double now = wall_seconds();
+    if(p.max_wall_seconds > 0 && now - start >= p.max_wall_seconds) {
+        ctx.stopped = "time limit";
+    } else if(p.interruptible && interrupt_pending()) {
+        ctx.stopped = "interrupted";
+    }
+    if(!ctx.stopped.empty()) {return;}
+
+    if(p.progress_every > 0 && now - last >= p.progress_every && (p.verbose || p.progress_callback != R_NilValue)) {
+        report(ctx, now, population, events, target);
+    }
+}
+
+void Progress::report(SimContext &ctx, const double now, const double population, const double events, const double target) {
+    const double rate = (events - last_events)/(now - last);
+    double eta = NA_REAL;
+    if(population > last_population && last_population > 0) {
+        eta = std::max(0.0, log(target/population)*(now - last)/log(population/last_population));
+    }
+    last = now;
+    last_population = population;
+    last_events = events;
+
+    if(p.verbose) {
+        Rcpp::Rcout << "Simulated time: " << ctx.time << " days. Population is " << population << " cells, "
+                    << rate << " events per second";
+        if(!ISNA(eta)) {Rcpp::Rcout << ", about " << eta << " s left";}
+        Rcpp::Rcout << ". \n";
+    }
+    if(p.progress_callback != R_NilValue) {
+        Rcpp::List out = Rcpp::List::create();
+        out.push_back(population, "cells");
+        out.push_back(ctx.time, "time");
+        out.push_back(rate, "events_per_second");
+        out.push_back(eta, "eta_seconds");
+        out.push_back(now - start, "elapsed_seconds");
+        Rcpp::Function callback(p.progress_callback);
+        callback(out);
+    }
+}
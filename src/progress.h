@@ -0,0 +1,56 @@
+/*
+SITH: An R package for visualizing and analyzing a spatial model of intra-tumor heterogeneity
+Author: Phillip Nicol
+License: GPL-2
+*/
+
+/***********************************************************
+Progress of a running simulation. The engine counts down POLL_EVENTS events between two looks at
+the clock, so the main loop only pays for one decrement per event, and the timed checkpoints are
+written at the same looks. At each look the run stops if its
+wall clock budget is spent, or if the user has asked R to interrupt it. The interrupt is caught with
+R_ToplevelExec instead of jumping out of the engine, so the simulation ends like any other: the
+lattice is released, a last snapshot is written if checkpoints were asked for, and the tumor grown so
+far is returned. Worker threads must not call into R, so a run that is not interruptible (a replicate
+of a batch) only checks its budget.
+Every progress_every seconds the population, the simulated time, the events per second and the time
+left are reported to the console (if verbose) and to an R function (if one was given). The time left
+assumes the log of the population keeps growing as fast as it did since the last report.
+*******************************************************/
+
+#ifndef PROGRESS_H_INCLUDED
+#define PROGRESS_H_INCLUDED
+
+#include"context.h"
+
+//events between two looks at the clock
+#define POLL_EVENTS 65536
+
+class Progress {
+public:
+    Progress(const SimContext &ctx, const SimParams &p);
+
+    //called after every event of the serial engine, true once every POLL_EVENTS events
+    inline bool due() {
+        if(--countdown == 0) {
+            countdown = POLL_EVENTS;
+            return true;
+        }
+        return false;
+    }
+
+    //look at the clock, given the population and the events of the run so far. Sets ctx.stopped if the
+    //run has to stop
+    void poll(SimContext &ctx, const double population, const double events, const double target);
+
+private:
+    const SimParams &p;
+    int countdown;
+    double start;
+    //the last report
+    double last, last_population, last_events;
+
+    void report(SimContext &ctx, const double now, const double population, const double events, const double target);
+};
+
+#endif
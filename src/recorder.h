@@ -0,0 +1,129 @@
+/*
+SITH: An R package for visualizing and analyzing a spatial model of intra-tumor heterogeneity
+Author: Phillip Nicol
+License: GPL-2
+*/
+
+/***********************************************************
+A Recorder follows the clones of a tumor while it grows. At chosen points (simulated times, and the
+first time the population reaches chosen sizes) it appends a record with the time, the population,
+the number of alleles alive, the number of cells carrying a driver and the fraction of resistant cells.
+Alongside, it keeps the count of every allele, but only for the alleles whose count changed since the
+previous record (an allele keeps its count until it appears again), so frequent records of a large
+tumor stay small.
+After every event the engine only compares the time and the population against the next record point.
+All of the work is done at the record points, in one pass over the alleles.
+Everything is stored in columns, which are returned to R as they are.
+*******************************************************/
+
+#ifndef RECORDER_H_INCLUDED
+#define RECORDER_H_INCLUDED
+
+#include"simutils.h"
+
+class Recorder {
+public:
+    Recorder() {init(std::vector<double>(), std::vector<double>());}
+
+    //record at the given simulated times and population sizes
+    void init(const std::vector<double> &record_times, const std::vector<double> &record_sizes) {
+        times = record_times;
+        sizes = record_sizes;
+        std::sort(times.begin(), times.end());
+        std::sort(sizes.begin(), sizes.end());
+        next_t = 0; next_s = 0;
+        next_time = times.empty() ? HUGE_VAL : times[0];
+        next_size = sizes.empty() ? HUGE_VAL : sizes[0];
+        last.clear();
+        driver.clear();
+        time.clear(); cells.clear(); alleles.clear(); driver_cells.clear(); resistant.clear();
+        clone_record.clear(); clone_allele.clear(); clone_count.clear();
+    }
+
+    bool active() const {return !times.empty() || !sizes.empty();}
+
+    inline bool due(const double t, const size_t population) const {
+        return t >= next_time || population >= next_size;
+    }
+
+    //append a record (Species as described at specie in simutils.h)
+    template<class Species>
+    void record(const double t, const size_t population, Species &species, const int nspecies,
+                const std::vector<int> &drivers) {
+        //move past every record point that has been reached
+        while(t >= next_time) {
+            ++next_t;
+            next_time = next_t < times.size() ? times[next_t] : HUGE_VAL;
+        }
+        while(population >= next_size) {
+            ++next_s;
+            next_size = next_s < sizes.size() ? sizes[next_s] : HUGE_VAL;
+        }
+        if(!active()) {return;}
+        //nothing has happened since the last record
+        if(!time.empty() && time.back() == t && cells.back() == population) {return;}
+
+        //alleles are never removed, so the new ones are the ones at the end
+        for(int i = driver.size(); i < nspecies; ++i) {
+            const specie &sp = species[i];
+            bool d;
+            if(sp.parent == -1) {
+                //the wild type, or a disease model genotype that has left the initial state
+                d = sp.genotype.size() > 1;
+            } else {
+                d = driver[sp.parent];
+                for(int j = 0; j < sp.genotype.size() && !d; ++j) {
+                    d = std::binary_search(drivers.begin(), drivers.end(), sp.genotype[j]);
+                }
+            }
+            driver.push_back(d);
+        }
+        last.resize(nspecies, 0);
+
+        const int r = time.size();
+        int alive = 0;
+        double ndriver = 0, nresistant = 0;
+        for(int i = 0; i < nspecies; ++i) {
+            const specie &sp = species[i];
+            if(sp.count != last[i]) {
+                clone_record.push_back(r);
+                clone_allele.push_back(i);
+                clone_count.push_back(sp.count);
+                last[i] = sp.count;
+            }
+            if(sp.count > 0) {
+                ++alive;
+                if(driver[i]) {ndriver += sp.count;}
+                if(sp.treatment_resistance) {nresistant += sp.count;}
+            }
+        }
+        time.push_back(t);
+        cells.push_back(population);
+        alleles.push_back(alive);
+        driver_cells.push_back(ndriver);
+        resistant.push_back(population > 0 ? nresistant/population : 0);
+    }
+
+    //one row per record
+    std::vector<double> time;
+    std::vector<double> cells;
+    std::vector<int> alleles;
+    std::vector<double> driver_cells;
+    std::vector<double> resistant;
+
+    //one row per allele whose count changed at a record (records are numbered from 0)
+    std::vector<int> clone_record;
+    std::vector<int> clone_allele;
+    std::vector<int> clone_count;
+
+private:
+    std::vector<double> times, sizes;
+    size_t next_t, next_s;
+    double next_time, next_size;
+
+    //count of every allele at the last record, and whether it carries a driver
+    std::vector<int> last;
+    std::vector<bool> driver;
+};
+
+#endif
@@ -0,0 +1,131 @@
+#include"render.h"
+#include"sampling.h"
+#include<stdint.h>
+#include<algorithm>
+
+Rcpp::List Render::surface(Rcpp::List input) {
+    Rcpp::IntegerVector x = input["x"], y = input["y"], z = input["z"], genotype = input["genotype"];
+    const bool exposed_only = input["surface"];
+    const int lod = input["lod"];
+    const int nthreads = input["nthreads"];
+    const int ncells = x.size();
+    TumorIndex index(x, y, z, genotype);
+
+    //a cell is exposed if one of its neighbors is empty (every cell is kept if surface is false). Blocks of cells are checked in parallel and
+    //joined in order, so the result does not depend on the threads
+    const int *px = x.begin(), *py = y.begin(), *pz = z.begin();
+    const int nblocks = std::max(1, std::min(ncells, 16*nthreads));
+    std::vector<std::vector<int> > found(nblocks);
+    #pragma omp parallel for schedule(dynamic) num_threads(nthreads)
+    for(int t = 0; t < nblocks; ++t) {
+        const int from = (int)((double)ncells*t/nblocks), to = (int)((double)ncells*(t+1)/nblocks);
+        for(int c = from; c < to; ++c) {
+            const int cx = px[c], cy = py[c], cz = pz[c];
+            if(!exposed_only || index.at(cx + 1, cy, cz) < 0 || index.at(cx - 1, cy, cz) < 0 || index.at(cx, cy + 1, cz) < 0 ||
+               index.at(cx, cy - 1, cz) < 0 || index.at(cx, cy, cz + 1) < 0 || index.at(cx, cy, cz - 1) < 0) {
+                found[t].push_back(c);
+            }
+        }
+    }
+    std::vector<int> exposed;
+    for(int t = 0; t < nblocks; ++t) {exposed.insert(exposed.end(), found[t].begin(), found[t].end());}
+
+    Rcpp::List out = Rcpp::List::create();
+    if(lod <= 1) {
+        Rcpp::IntegerVector ex(exposed.size()), ey(exposed.size()), ez(exposed.size()), row(exposed.size());
+        for(int k = 0; k < exposed.size(); ++k) {
+            const int c = exposed[k];
+            ex[k] = px[c]; ey[k] = py[c]; ez[k] = pz[c]; row[k] = c + 1;
+        }
+        out.push_back(ex, "x");
+        out.push_back(ey, "y");
+        out.push_back(ez, "z");
+        out.push_back(row, "row");
+        return out;
+    }
+
+    //The exposed cells are sorted by block, then by allele, so the cells of an allele in a block are
+    //next to each other and the first one has the smallest row
+    int nalleles = 1;
+    for(int c = 0; c < ncells; ++c) {nalleles = std::max(nalleles, genotype[c] + 1);}
+    const uint64_t nbx = (index.hi[0] - index.lo[0])/lod + 1, nby = (index.hi[1] - index.lo[1])/lod + 1;
+    std::vector<std::pair<uint64_t, int> > keys(exposed.size());
+    for(int k = 0; k < exposed.size(); ++k) {
+        const int c = exposed[k];
+        const uint64_t block = ((uint64_t)((pz[c] - index.lo[2])/lod)*nby + (py[c] - index.lo[1])/lod)*nbx +
+                               (px[c] - index.lo[0])/lod;
+        keys[k] = std::make_pair(block*nalleles + genotype[c], c);
+    }
+    std::sort(keys.begin(), keys.end());
+
+    //each block is drawn with the allele of most of its exposed cells (the smallest allele on ties)
+    std::vector<double> bx, by, bz;
+    std::vector<int> row;
+    for(size_t k = 0; k < keys.size();) {
+        const uint64_t block = keys[k].first/nalleles;
+        int best = -1, best_count = 0;
+        while(k < keys.size() && keys[k].first/nalleles == block) {
+            size_t end = k;
+            while(end < keys.size() && keys[end].first == keys[k].first) {++end;}
+            if((int)(end - k) > best_count) {best_count = end - k; best = keys[k].second;}
+            k = end;
+        }
+        const int ix = block % nbx, iy = (block/nbx) % nby, iz = block/(nbx*nby);
+        bx.push_back(index.lo[0] + ix*lod + (lod - 1)/2.0);
+        by.push_back(index.lo[1] + iy*lod + (lod - 1)/2.0);
+        bz.push_back(index.lo[2] + iz*lod + (lod - 1)/2.0);
+        row.push_back(best + 1);
+    }
+    out.push_back(Rcpp::wrap(bx), "x");
+    out.push_back(Rcpp::wrap(by), "y");
+    out.push_back(Rcpp::wrap(bz), "z");
+    out.push_back(Rcpp::wrap(row), "row");
+    return out;
+}
+
+Rcpp::List Render::slices(Rcpp::List input) {
+    Rcpp::IntegerVector x = input["x"], y = input["y"], z = input["z"], genotype = input["genotype"];
+    Rcpp::IntegerVector levels = input["levels"];
+    const int axis = input["axis"];
+    const int nthreads = input["nthreads"];
+    const int ncells = x.size(), nlevels = levels.size();
+
+    //the rows and columns of a raster are the two other dimensions, in order
+    const int *pc[3] = {x.begin(), y.begin(), z.begin()};
+    const int *ps = pc[axis], *pu = pc[axis == 0 ? 1 : 0], *pv = pc[axis == 2 ? 1 : 2];
+    int lo[3] = {0, 0, 0}, hi[3] = {-1, -1, -1};
+    for(int d = 0; d < 3; ++d) {
+        for(int c = 0; c < ncells; ++c) {
+            if(c == 0 || pc[d][c] < lo[d]) {lo[d] = pc[d][c];}
+            if(c == 0 || pc[d][c] > hi[d]) {hi[d] = pc[d][c];}
+        }
+    }
+    const int du = axis == 0 ? 1 : 0, dv = axis == 2 ? 1 : 2;
+    const int nu = hi[du] - lo[du] + 1, nv = hi[dv] - lo[dv] + 1;
+
+    //raster of each value of the sliced coordinate, -1 if it was not requested
+    std::vector<int> frame(hi[axis] - lo[axis] + 1, -1);
+    for(int k = 0; k < nlevels; ++k) {
+        if(levels[k] >= lo[axis] && levels[k] <= hi[axis]) {frame[levels[k] - lo[axis]] = k;}
+    }
+
+    //a site holds at most one cell, so the threads never write to the same entry
+    Rcpp::IntegerVector raster(Rcpp::no_init((size_t)nu*nv*nlevels));
+    int *pr = raster.begin();
+    const int *pg = genotype.begin();
+    std::fill(pr, pr + (size_t)nu*nv*nlevels, NA_INTEGER);
+    #pragma omp parallel for schedule(static) num_threads(nthreads)
+    for(int c = 0; c < ncells; ++c) {
+        const int k = frame[ps[c] - lo[axis]];
+        if(k >= 0) {
+            pr[((size_t)k*nv + (pv[c] - lo[dv]))*nu + (pu[c] - lo[du])] = pg[c];
+        }
+    }
+    raster.attr("dim") = Rcpp::IntegerVector::create(nu, nv, nlevels);
+
+    Rcpp::List out = Rcpp::List::create();
+    out.push_back(raster, "raster");
+    out.push_back(Rcpp::seq(lo[du], hi[du]), "u");
+    out.push_back(Rcpp::seq(lo[dv], hi[dv]), "v");
+    return out;
+}
@@ -0,0 +1,33 @@
+/*
+SITH: An R package for visualizing and analyzing a spatial model of intra-tumor heterogeneity
+Author: Phillip Nicol
+License: GPL-2
+*/
+
+/***********************************************************
+Reduction of a tumor to the points that are worth drawing. A cell can only be seen if one of its six
+neighbors is empty, so the interior of the tumor is dropped using the grid of the tumor by position.
+For a coarser view the exposed cells are then merged by blocks of k*k*k sites, each block being
+drawn at its center with the allele that most of its exposed cells have. Every point keeps the row
+of a cell it stands for, so it can be colored like that cell.
+Cross sections are rasterized as matrices of alleles over the bounding box of the tumor in the two
+other dimensions. Any number of levels is filled in one pass over the cells: a table from the sliced
+coordinate to the requested levels sends each cell straight to its raster.
+*******************************************************/
+
+#ifndef RENDER_H_INCLUDED
+#define RENDER_H_INCLUDED
+
+#include<Rcpp.h>
+
+namespace Render {
+    //Positions of the exposed cells (or of all the cells), or of blocks of them, and the row (1-based) of
+    //a cell for each
+    Rcpp::List surface(Rcpp::List input);
+
+    //Alleles of the cells at each level of one dimension, as an array with one matrix per level (NA where
+    //there is no cell) and the coordinates of its rows and columns
+    Rcpp::List slices(Rcpp::List input);
+}
+
+#endif
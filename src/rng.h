@@ -0,0 +1,207 @@
+/*
+SITH: An R package for visualizing and analyzing a spatial model of intra-tumor heterogeneity
+Author: Phillip Nicol
+License: GPL-2
+*/
+
+/***********************************************************
+Random number generation for the simulation.
+By default every draw goes through R's generator, so results can be reproduced with set.seed().
+When a seed is passed to the simulation, draws come from an in-package xoshiro256++ generator
+instead. This avoids a call into R for every uniform, and the samplers below are simple enough
+to be inlined in the event loop.
+The generator can jump ahead by 2^128 draws, so stream k of a seed (the seeded generator
+jumped k times) never overlaps with any other stream of the same seed. Independent runs or
+threads should each take their own stream. Within a run, a stream can be split in two with a
+jump of 2^192 draws. R's generator can only be used from the main thread.
+*******************************************************/
+
+#ifndef RNG_H_INCLUDED
+#define RNG_H_INCLUDED
+
+#include<stdint.h>
+#include<cmath>
+#include<Rcpp.h>
+
+class Xoshiro256 {
+public:
+    Xoshiro256() {seed(0);}
+
+    //fill the state from the seed with splitmix64, as recommended by the authors of xoshiro
+    void seed(uint64_t seed) {
+        for(int i = 0; i < 4; ++i) {
+            seed += 0x9e3779b97f4a7c15ULL;
+            uint64_t z = seed;
+            z = (z ^ (z >> 30))*0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27))*0x94d049bb133111ebULL;
+            s[i] = z ^ (z >> 31);
+        }
+    }
+
+    inline uint64_t next() {
+        const uint64_t result = rotl(s[0] + s[3], 23) + s[0];
+        const uint64_t t = s[1] << 17;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl(s[3], 45);
+        return result;
+    }
+
+    //uniform on [0,1) with 53 random bits
+    inline double uniform() {
+        return (next() >> 11)*(1.0/9007199254740992.0);
+    }
+
+    //equivalent to 2^128 calls to next()
+    void jump() {
+        static const uint64_t JUMP[] = {0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL,
+            0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL};
+        uint64_t t[4] = {0, 0, 0, 0};
+        for(int i = 0; i < 4; ++i) {
+            for(int b = 0; b < 64; ++b) {
+                if(JUMP[i] & ((uint64_t)1 << b)) {
+                    t[0] ^= s[0]; t[1] ^= s[1]; t[2] ^= s[2]; t[3] ^= s[3];
+                }
+                next();
+            }
+        }
+        s[0] = t[0]; s[1] = t[1]; s[2] = t[2]; s[3] = t[3];
+    }
+
+    //equivalent to 2^192 calls to next()
+    void long_jump() {
+        static const uint64_t LONG_JUMP[] = {0x76e15d3efefdcbbfULL, 0xc5004e441c522fb3ULL,
+            0x77710069854ee241ULL, 0x39109bb02acbe635ULL};
+        uint64_t t[4] = {0, 0, 0, 0};
+        for(int i = 0; i < 4; ++i) {
+            for(int b = 0; b < 64; ++b) {
+                if(LONG_JUMP[i] & ((uint64_t)1 << b)) {
+                    t[0] ^= s[0]; t[1] ^= s[1]; t[2] ^= s[2]; t[3] ^= s[3];
+                }
+                next();
+            }
+        }
+        s[0] = t[0]; s[1] = t[1]; s[2] = t[2]; s[3] = t[3];
+    }
+
+private:
+    uint64_t s[4];
+
+    inline static uint64_t rotl(const uint64_t x, const int k) {
+        return (x << k) | (x >> (64 - k));
+    }
+};
+
+//The random numbers of one simulation. Each simulation owns its stream, so simulations running at
+//the same time (on different threads) do not share any state, as long as they use the native generator
+class RandomStream {
+public:
+    RandomStream() : native(false) {}
+
+    //use stream k of the given seed
+    void seed(const double seed, const int stream) {
+        native = true;
+        engine.seed((uint64_t)seed);
+        for(int k = 0; k < stream; ++k) {
+            engine.jump();
+        }
+    }
+
+    //use the given state of the in-package generator
+    void seed(const Xoshiro256 &state) {
+        native = true;
+        engine = state;
+    }
+
+    //use the in-package generator if the input list has a seed, and R's generator otherwise
+    void init(Rcpp::List input) {
+        native = false;
+        if(input.containsElementNamed("seed")) {
+            double s = input["seed"];
+            seed(s, 0);
+        }
+    }
+
+    //child continues with the draws of this stream, which skips ahead by 2^192 draws
+    void split(RandomStream &child) {
+        child.seed(engine);
+        engine.long_jump();
+    }
+
+    bool is_native() const {return native;}
+
+    //state of the in-package generator (for checkpoints)
+    const Xoshiro256 &generator() const {return engine;}
+
+    inline double runif(const double a, const double b) {
+        if(!native) {return R::runif(a, b);}
+        return a + (b - a)*engine.uniform();
+    }
+
+    //exponential with mean (not rate) scale, as in R::rexp
+    inline double rexp(const double scale) {
+        if(!native) {return R::rexp(scale);}
+        return -scale*log(1.0 - engine.uniform());
+    }
+
+    //a single Bernoulli trial, the same as R::rbinom(1,p)
+    inline int rbern(const double p) {
+        if(!native) {return (int)R::rbinom(1, p);}
+        return engine.uniform() < p;
+    }
+
+    inline double rnorm(const double mu, const double sigma) {
+        if(!native) {return R::rnorm(mu, sigma);}
+        //Marsaglia's polar method
+        double v1, v2, r;
+        do {
+            v1 = 2*engine.uniform() - 1;
+            v2 = 2*engine.uniform() - 1;
+            r = v1*v1 + v2*v2;
+        } while(r >= 1 || r == 0);
+        return mu + sigma*v1*sqrt(-2*log(r)/r);
+    }
+
+    inline int rpois(const double mu) {
+        if(!native) {return (int)R::rpois(mu);}
+        if(mu <= 0) {return 0;}
+        if(mu < 10) {
+            //multiply uniforms until the product falls below exp(-mu)
+            const double limit = exp(-mu);
+            int k = 0;
+            double prod = engine.uniform();
+            while(prod > limit) {
+                ++k;
+                prod *= engine.uniform();
+            }
+            return k;
+        }
+        //transformed rejection with squeeze (Hormann 1993)
+        const double slam = sqrt(mu), loglam = log(mu);
+        const double b = 0.931 + 2.53*slam;
+        const double a = -0.059 + 0.02483*b;
+        const double invalpha = 1.1239 + 1.1328/(b - 3.4);
+        const double vr = 0.9277 - 3.6224/(b - 2);
+        while(true) {
+            const double U = engine.uniform() - 0.5;
+            const double V = engine.uniform();
+            const double us = 0.5 - fabs(U);
+            const double k = floor((2*a/us + b)*U + mu + 0.43);
+            if(us >= 0.07 && V <= vr) {return (int)k;}
+            if(k < 0 || (us < 0.013 && V > us)) {continue;}
+            if(log(V) + log(invalpha) - log(a/(us*us) + b) <= -mu + k*loglam - lgamma(k + 1)) {
+                return (int)k;
+            }
+        }
+    }
+
+private:
+    //true if draws come from the in-package generator rather than from R
+    bool native;
+    Xoshiro256 engine;
+};
+
+#endif
@@ -5,14 +5,24 @@ License: GPL-2
 */
 
 /***********************************************************
-random_index samples a random cell to be used in gillespie_step
-Uniform random sampling can not be used because cells with different birth and death rates have
-different probabilities of being selected.
-Inverse transform sampling is O(n) in our setup, so this is infeasible as well. We want a sampler
-that can be relied upon to be O(1). 
-We use rejection sampling. Let p_max = max_i (b_i + d_i)
-Given candidate cell (sampled uniformly random) and index j with sum of birth and death rate b_j + d_j, we generate
-uniform rv u ~ U[0, p_max] and accept the cell if u < b_j + d_j and reject otherwise. 
+Events are split into two channels. A birth can only happen to a cell with at least one free neighbor
+(the boundary of the tumor), while any cell can die. The engine keeps the boundary cells in a sampler
+and the total rate of each channel up to date as cells are born and die, so the next event is 
+chosen by first picking a channel with probability proportional to its total rate and then 
+picking a cell within the channel. Interior cells are never drawn for a birth that can not happen.
+When most cells are on the boundary the engine draws from all cells instead, see gillespie.h.
+
+Within a channel, inverse transform sampling is O(n) in our setup, so this is infeasible. We want 
+a sampler that can be relied upon to be O(1). 
+Births use composition-rejection sampling. Boundary cells are grouped by their birth rate into buckets
+[2^(k-1), 2^k). A bucket is chosen with probability proportional to the total rate of its cells
+(there are only a handful of non-empty buckets), then a cell j is chosen uniformly within the bucket
+and accepted if u < b_j for u ~ U[0, m_k], where m_k < 2^k is the largest rate in the bucket. Every 
+cell in the bucket is accepted with probability at least 1/2, however large the spread of birth 
+rates is. m_k is reset whenever bucket k empties, so the largest rate in the sampler follows the 
+clones that are alive rather than the largest rate ever seen. 
+Deaths use plain rejection sampling: a cell j is sampled uniformly from all cells and accepted 
+if u < d_j for u ~ U[0, d_max]. 
 This obtains the correct sampling probabilities, and for our purposes can be expected
 to almost always accept a cell in very few iterations. 
 *******************************************************/
@@ -20,27 +30,181 @@ to almost always accept a cell in very few iterations.
 #ifndef SAMPLER_H_INCLUDED
 #define SAMPLER_H_INCLUDED
 
-extern double p_max;
+#include<cstring>
+#include"simutils.h"
+
+//bucket k holds rates in [2^(k - RATE_OFFSET - 1), 2^(k - RATE_OFFSET))
+#define RATE_BUCKETS 128
+#define RATE_OFFSET 64
+
+struct BucketEntry {
+    int index;
+    double rate;
+};
+
+class RateSampler {
+public:
+    RateSampler() {clear();}
+
+    void clear() {
+        for(int k = 0; k < RATE_BUCKETS; ++k) {
+            members[k].clear();
+            totals[k] = 0;
+            bmax[k] = 0;
+        }
+        lo = RATE_BUCKETS; hi = -1;
+        sum = 0; count = 0;
+        max_seen = 0;
+        trials = 0; accepted = 0; uniform_trials = 0;
+        nraises = 0;
+    }
+
+    //add the cell at index with the given rate (cells with rate 0 are never sampled and are left out)
+    inline void insert(std::vector<cell> &cells, const int index, const double rate) {
+        cells[index].bucket = -1;
+        if(rate <= 0) {return;}
+
+        int k;
+        frexp(rate, &k);
+        k = std::min(std::max(k + RATE_OFFSET, 0), RATE_BUCKETS - 1);
+
+        BucketEntry entry = {index, rate};
+        cells[index].bucket = k;
+        cells[index].bpos = members[k].size();
+        members[k].push_back(entry);
+        totals[k] += rate;
+        if(rate > bmax[k]) {bmax[k] = rate;}
+        sum += rate;
+        ++count;
+
+        if(k < lo) {lo = k;}
+        if(k > hi) {hi = k;}
+        if(rate > max_seen) {max_seen = rate; ++nraises;}
+    }
+
+    //remove the cell at index (if it is in the sampler)
+    inline void remove(std::vector<cell> &cells, const int index) {
+        const int k = cells[index].bucket;
+        if(k == -1) {return;}
+
+        std::vector<BucketEntry> &m = members[k];
+        const int pos = cells[index].bpos;
+        const double rate = m[pos].rate;
+        m[pos] = m.back();
+        cells[m[pos].index].bpos = pos;
+        m.pop_back();
+        cells[index].bucket = -1;
+        --count;
+
+        if(m.empty()) {
+            //reset the sums exactly so rounding errors do not build up
+            totals[k] = 0;
+            bmax[k] = 0;
+            sum = 0;
+            for(int j = lo; j <= hi; ++j) {sum += totals[j];}
+            while(lo <= hi && members[lo].empty()) {++lo;}
+            while(hi >= lo && members[hi].empty()) {--hi;}
+            if(lo > hi) {lo = RATE_BUCKETS; hi = -1;}
+        } else {
+            totals[k] -= rate;
+            sum -= rate;
+        }
+    }
+
+    //the cell now at index was moved there from another index
+    inline void move(std::vector<cell> &cells, const int index) {
+        if(cells[index].bucket != -1) {
+            members[cells[index].bucket][cells[index].bpos].index = index;
+        }
+    }
+
+    inline int sample(RandomStream &rng) {
+        //expected number of trials plain rejection sampling would need for this draw
+        uniform_trials += count*max_seen/sum;
+        while(true) {
+            ++trials;
+            //choose a bucket with probability proportional to its total rate
+            double u = rng.runif(0, sum);
+            int k = hi;
+            while(k > lo && u >= totals[k]) {
+                u -= totals[k];
+                --k;
+            }
+            //then a cell uniformly within the bucket, accepted with probability rate/m_k
+            const std::vector<BucketEntry> &m = members[k];
+            const BucketEntry &entry = m[(int)rng.runif(0, m.size())];
+            if(entry.rate >= bmax[k] || rng.runif(0, bmax[k]) < entry.rate) {
+                ++accepted;
+                return entry.index;
+            }
+        }
+    }
 
-inline int selectIndexRS(std::vector<cell> &cells, std::vector<specie> &species)
-{
-    int index, trial;
-    double u_trial;
+    double total() const {return sum;}
+    int size() const {return count;}
 
-    while(true)
-    {
-        trial = R::runif(0, cells.size());
-        u_trial = R::runif(0, p_max);
+    //largest rate in the sampler (up to rates of cells that left the top bucket while it was not empty)
+    double max_rate() const {return hi >= 0 ? bmax[hi] : 0;}
 
-        specie cell_species = species[cells[trial].id];
-        
-        if(u_trial < cell_species.b + cell_species.d)
-        {
-            index = trial;
-            break;
+    //fraction of trials accepted
+    double acceptance() const {return trials > 0 ? accepted/trials : 1;}
+
+    //acceptance plain rejection sampling (against the largest rate seen so far) would have had
+    double uniform_acceptance() const {return uniform_trials > 0 ? accepted/uniform_trials : 1;}
+
+    //trials and accepted trials so far, and the times the largest rate seen went up since the sampler was
+    //cleared (the last is not kept in snapshots)
+    double draws() const {return trials;}
+    double hits() const {return accepted;}
+    double raises() const {return nraises;}
+
+    //The running sums of the sampler, for checkpoints. They are copied rather than recomputed, 
+    //since adding the rates up again would round differently
+    struct Sums {
+        double totals[RATE_BUCKETS];
+        double bmax[RATE_BUCKETS];
+        double sum, max_seen;
+        double trials, accepted, uniform_trials;
+        int lo, hi, count, unused;
+    };
+
+    Sums sums() const {
+        Sums out;
+        memcpy(out.totals, totals, sizeof(totals));
+        memcpy(out.bmax, bmax, sizeof(bmax));
+        out.sum = sum; out.max_seen = max_seen;
+        out.trials = trials; out.accepted = accepted; out.uniform_trials = uniform_trials;
+        out.lo = lo; out.hi = hi; out.count = count; out.unused = 0;
+        return out;
+    }
+
+    //rebuild the buckets from the position stored with each cell, in the same order as before
+    void restore(const std::vector<cell> &cells, const std::vector<specie> &species, const Sums &in) {
+        for(int k = 0; k < RATE_BUCKETS; ++k) {members[k].clear();}
+        for(int i = 0; i < cells.size(); ++i) {
+            const int k = cells[i].bucket;
+            if(k == -1) {continue;}
+            if(members[k].size() <= cells[i].bpos) {members[k].resize(cells[i].bpos + 1);}
+            BucketEntry entry = {i, species[cells[i].id].b};
+            members[k][cells[i].bpos] = entry;
         }
+        memcpy(totals, in.totals, sizeof(totals));
+        memcpy(bmax, in.bmax, sizeof(bmax));
+        sum = in.sum; max_seen = in.max_seen;
+        trials = in.trials; accepted = in.accepted; uniform_trials = in.uniform_trials;
+        lo = in.lo; hi = in.hi; count = in.count;
     }
-    return index;
-}
 
-#endif 
\ No newline at end of file
+private:
+    std::vector<BucketEntry> members[RATE_BUCKETS];
+    double totals[RATE_BUCKETS];
+    double bmax[RATE_BUCKETS];
+    int lo, hi;
+    double sum;
+    int count;
+    double max_seen;
+    double trials, accepted, uniform_trials;
+    double nraises;
+};
+
+#endif
@@ -0,0 +1,222 @@
+#include"sampling.h"
+#include<climits>
+#include<cmath>
+#include<algorithm>
+
+TumorIndex::TumorIndex(const Rcpp::IntegerVector &x, const Rcpp::IntegerVector &y, const Rcpp::IntegerVector &z,
+                       const Rcpp::IntegerVector &genotype) {
+    const int ncells = x.size();
+    for(int d = 0; d < 3; ++d) {lo[d] = INT_MAX; hi[d] = INT_MIN;}
+    for(int i = 0; i < ncells; ++i) {
+        lo[0] = std::min(lo[0], x[i]); hi[0] = std::max(hi[0], x[i]);
+        lo[1] = std::min(lo[1], y[i]); hi[1] = std::max(hi[1], y[i]);
+        lo[2] = std::min(lo[2], z[i]); hi[2] = std::max(hi[2], z[i]);
+    }
+    if(ncells == 0) {
+        for(int d = 0; d < 3; ++d) {lo[d] = 0; hi[d] = -1;}
+    }
+    for(int d = 0; d < 3; ++d) {n[d] = hi[d] - lo[d] + 1;}
+
+    grid.assign(n[0]*n[1]*n[2], 0);
+    for(int i = 0; i < ncells; ++i) {
+        grid[((size_t)(z[i] - lo[2])*n[1] + (y[i] - lo[1]))*n[0] + (x[i] - lo[0])] = genotype[i] + 1;
+    }
+}
+
+//Counts indexed by allele or mutation. Only the entries that were touched are reset between samples
+struct SparseCounts {
+    std::vector<int> count;
+    std::vector<int> touched;
+
+    SparseCounts(const int size) : count(size, 0) {}
+
+    inline void add(const int i, const int c) {
+        if(count[i] == 0) {touched.push_back(i);}
+        count[i] += c;
+    }
+
+    void clear() {
+        for(size_t k = 0; k < touched.size(); ++k) {count[touched[k]] = 0;}
+        touched.clear();
+    }
+};
+
+Rcpp::List Sampling::bulk(Rcpp::List input) {
+    Rcpp::IntegerVector x = input["x"], y = input["y"], z = input["z"], genotype = input["genotype"];
+    TumorIndex index(x, y, z, genotype);
+    Rcpp::IntegerVector offsets = input["offsets"];
+    Rcpp::IntegerVector mutations = input["mutations"];
+    Rcpp::NumericMatrix centers = input["centers"];
+    const double threshold = input["threshold"];
+
+    //needles run along one axis through the whole tumor, cubes extend half on each side of their center
+    const bool needle = input.containsElementNamed("axis");
+    Rcpp::IntegerVector axis;
+    double half = 0, size = 0;
+    if(needle) {
+        axis = input["axis"];
+    } else {
+        half = input["half"];
+        size = input["size"];
+    }
+
+    const int nentries = mutations.size();
+    int nmutations = 0;
+    for(int j = 0; j < nentries; ++j) {nmutations = std::max(nmutations, mutations[j] + 1);}
+    SparseCounts alleles(offsets.size() - 1), muts(nmutations);
+
+    std::vector<int> sample, mutation;
+    std::vector<double> frequency;
+    Rcpp::IntegerVector ncells(centers.nrow());
+    for(int s = 0; s < centers.nrow(); ++s) {
+        int cells = 0;
+        if(needle) {
+            const int a = axis[s];
+            int site[3] = {(int)centers(s, 0), (int)centers(s, 1), (int)centers(s, 2)};
+            for(site[a] = index.lo[a]; site[a] <= index.hi[a]; ++site[a]) {
+                const int g = index.at(site[0], site[1], site[2]);
+                if(g >= 0) {alleles.add(g, 1); ++cells;}
+            }
+        } else {
+            int from[3], to[3];
+            for(int d = 0; d < 3; ++d) {
+                from[d] = std::max(index.lo[d], (int)std::ceil(centers(s, d) - half));
+                to[d] = std::min(index.hi[d], (int)std::floor(centers(s, d) + half));
+            }
+            for(int z = from[2]; z <= to[2]; ++z) {
+                for(int y = from[1]; y <= to[1]; ++y) {
+                    for(int x = from[0]; x <= to[0]; ++x) {
+                        const int g = index.at(x, y, z);
+                        if(g >= 0) {alleles.add(g, 1); ++cells;}
+                    }
+                }
+            }
+        }
+        ncells[s] = cells;
+
+        //a mutation is carried by the cells of every allele that has it
+        for(size_t k = 0; k < alleles.touched.size(); ++k) {
+            const int g = alleles.touched[k];
+            for(int j = offsets[g]; j < offsets[g+1]; ++j) {
+                muts.add(mutations[j], alleles.count[g]);
+            }
+        }
+
+        //sites without cells are normal tissue in a cube, a needle only counts the cells it went through
+        const double denominator = needle ? cells : size;
+        std::sort(muts.touched.begin(), muts.touched.end());
+        for(size_t k = 0; k < muts.touched.size(); ++k) {
+            const int m = muts.touched[k];
+            const double f = muts.count[m]/denominator;
+            if(f > threshold) {
+                sample.push_back(s + 1);
+                mutation.push_back(m);
+                frequency.push_back(f);
+            }
+        }
+        alleles.clear();
+        muts.clear();
+    }
+
+    Rcpp::List out = Rcpp::List::create();
+    out.push_back(Rcpp::wrap(sample), "sample");
+    out.push_back(Rcpp::wrap(mutation), "mutation");
+    out.push_back(Rcpp::wrap(frequency), "frequency");
+    out.push_back(ncells, "ncells");
+    return out;
+}
+
+Rcpp::List Sampling::single_cells(Rcpp::List input) {
+    Rcpp::IntegerVector genotype = input["genotype"];
+    Rcpp::IntegerVector offsets = input["offsets"];
+    Rcpp::IntegerVector mutations = input["mutations"];
+    const double fpr = input["fpr"], fnr = input["fnr"];
+    const bool sparse = input["sparse"];
+    const int nthreads = input["nthreads"];
+    const int ncells = genotype.size();
+
+    //columns are numbered in the order the mutations are first seen
+    const int nentries = mutations.size();
+    int nmutations = 0;
+    for(int j = 0; j < nentries; ++j) {nmutations = std::max(nmutations, mutations[j] + 1);}
+    std::vector<int> column(nmutations, -1), column_mut, count;
+    for(int r = 0; r < ncells; ++r) {
+        for(int j = offsets[genotype[r]]; j < offsets[genotype[r]+1]; ++j) {
+            const int m = mutations[j];
+            if(column[m] == -1) {
+                column[m] = column_mut.size();
+                column_mut.push_back(m);
+                count.push_back(0);
+            }
+            ++count[column[m]];
+        }
+    }
+    const int ncols = column_mut.size();
+
+    //rows of the ones of each column, in increasing order since the cells are visited in order
+    std::vector<size_t> p(ncols + 1, 0);
+    for(int c = 0; c < ncols; ++c) {p[c+1] = p[c] + count[c];}
+    std::vector<int> rows(p[ncols]);
+    std::vector<size_t> next(p.begin(), p.end() - 1);
+    for(int r = 0; r < ncells; ++r) {
+        for(int j = offsets[genotype[r]]; j < offsets[genotype[r]+1]; ++j) {
+            rows[next[column[mutations[j]]]++] = r;
+        }
+    }
+
+    //false negatives: every one is lost with probability fnr
+    const size_t nnz = rows.size();
+    std::vector<bool> lost(nnz, false);
+    if(fnr > 0) {
+        for(double k = R::rgeom(fnr); k < nnz; k += 1 + R::rgeom(fnr)) {lost[(size_t)k] = true;}
+    }
+
+    //false positives: every zero becomes a one with probability fpr. The zeros are visited column by
+    //column, and the k-th zero of a column is in row k + (number of ones above it)
+    std::vector<size_t> q(ncols + 1, 0);
+    std::vector<int> noisy;
+    noisy.reserve(nnz);
+    double skip = fpr > 0 ? R::rgeom(fpr) : HUGE_VAL;
+    for(int c = 0; c < ncols; ++c) {
+        const size_t zeros = ncells - count[c];
+        size_t one = p[c];
+        for(; skip < zeros; skip += 1 + R::rgeom(fpr)) {
+            const size_t k = skip;
+            //keep the ones above the new one
+            while(one < p[c+1] && (size_t)rows[one] <= k + (one - p[c])) {
+                if(!lost[one]) {noisy.push_back(rows[one]);}
+                ++one;
+            }
+            noisy.push_back(k + (one - p[c]));
+        }
+        skip -= zeros;
+        for(; one < p[c+1]; ++one) {
+            if(!lost[one]) {noisy.push_back(rows[one]);}
+        }
+        q[c+1] = noisy.size();
+    }
+
+    Rcpp::List out = Rcpp::List::create();
+    out.push_back(Rcpp::wrap(column_mut), "mutations");
+    if(sparse) {
+        out.push_back(Rcpp::IntegerVector(q.begin(), q.end()), "p");
+        out.push_back(Rcpp::wrap(noisy), "i");
+        return out;
+    }
+
+    //The columns are allocated on the main thread and filled in parallel
+    Rcpp::List columns(ncols);
+    std::vector<int*> data(ncols);
+    for(int c = 0; c < ncols; ++c) {
+        Rcpp::IntegerVector v(Rcpp::no_init(ncells));
+        data[c] = v.begin();
+        columns[c] = v;
+    }
+    #pragma omp parallel for schedule(dynamic, 64) num_threads(nthreads)
+    for(int c = 0; c < ncols; ++c) {
+        std::fill(data[c], data[c] + ncells, 0);
+        for(size_t k = q[c]; k < q[c+1]; ++k) {data[c][noisy[k]] = 1;}
+    }
+    out.push_back(columns, "columns");
+    return out;
+}
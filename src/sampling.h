@@ -0,0 +1,56 @@
+/*
+SITH: An R package for visualizing and analyzing a spatial model of intra-tumor heterogeneity
+Author: Phillip Nicol
+License: GPL-2
+*/
+
+/***********************************************************
+Sequencing of a simulated tumor. The cells of the tumor are put into a dense grid over its bounding
+box that holds the allele of the cell at each site, so the cells of a sample are found by visiting
+the sites of the sample only. Cells are first counted per allele, and the mutations of each allele
+found in the sample are then credited with its count, so the cost of a sample is its volume plus the
+length of the genotypes of the alleles it holds, however large the tumor is.
+Single cell data is built as a sparse matrix, by column. Noise is added by skipping ahead to the next
+flipped entry with a geometric draw (over the ones for false negatives, over the zeros for false
+positives), so its cost is the number of flipped entries rather than the size of the matrix.
+Genotypes are given as offsets into a single vector of mutation IDs (the "csr" genotype format).
+*******************************************************/
+
+#ifndef SAMPLING_H_INCLUDED
+#define SAMPLING_H_INCLUDED
+
+#include<Rcpp.h>
+#include<vector>
+
+//the alleles of a tumor by position
+class TumorIndex {
+public:
+    TumorIndex(const Rcpp::IntegerVector &x, const Rcpp::IntegerVector &y, const Rcpp::IntegerVector &z,
+               const Rcpp::IntegerVector &genotype);
+
+    //allele of the cell at (x,y,z), -1 if there is none
+    inline int at(const int x, const int y, const int z) const {
+        if(x < lo[0] || x > hi[0] || y < lo[1] || y > hi[1] || z < lo[2] || z > hi[2]) {return -1;}
+        return grid[((size_t)(z - lo[2])*n[1] + (y - lo[1]))*n[0] + (x - lo[0])] - 1;
+    }
+
+    //bounding box of the cells (inclusive)
+    int lo[3], hi[3];
+
+private:
+    size_t n[3];
+    //allele + 1 at each site, 0 if the site is empty
+    std::vector<int> grid;
+};
+
+namespace Sampling {
+    //Allele frequencies of the mutations in cubes or needles (see R/sequencing.R), as
+    //(sample, mutation, frequency) rows with the frequencies above the threshold
+    Rcpp::List bulk(Rcpp::List input);
+
+    //Mutations of the sampled cells with false positives and negatives, one column per mutation found in
+    //the sample, as the columns of a data frame or as a sparse matrix in compressed column form
+    Rcpp::List single_cells(Rcpp::List input);
+}
+
+#endif
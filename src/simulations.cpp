@@ -1,188 +1,350 @@
 #include"simulations.h"
 
-Rcpp::List Sims::simulateIA(Rcpp::List input) {
-    //Read input list (from R)
-    std::vector<double> params = input["params"]; 
-    int tumor_size = params[0]; 
-    double wt_br = params[1]; 
-    double wt_dr = params[2]; 
-    double u = params[3]; 
-    double du = params[4]; 
-    double s = params[5]; 
-    bool verbose = params[6];
-    int recurrent_size = params[7];
-    double tr = params[8];
-
-
-    //Init time 
-    double time = 0; 
-
-    //initialize vector of cells:
-    std::vector<cell> cells; 
-    std::vector<specie> species;
-    cells.push_back(SimUtils::initial_cell(species, wt_br, wt_dr));
-
-    int index;
-    int iteration = 1;
-
-    //start clock
-    clock_t start, end; 
-    start = clock();
-
-    //main simulation loop
-    while(cells.size() < tumor_size)
+//serial growth until the tumor has target cells or the simulated time reaches until (or it has died out, or the
+//run is stopped)
+static void grow_serial(SimContext &ctx, const SimParams &p, const bool udt, const int target, const double until,
+                        Checkpointer &checkpoints, Progress &progress) {
+    std::vector<cell> &cells = ctx.cells;
+    while(cells.size() > 0 && cells.size() < target && ctx.time < until && ctx.stopped.empty())
     {
-        index = selectIndexRS(cells, species);
-        Gillespie::gillespieIA(cells, species, index, time, wt_dr, u, du, s, tr);
-        ++iteration;
-        if(iteration % interval == 0)
-        {
-            if(verbose) {Rcpp::Rcout << "Simulated time: " << time << " days. Population is " << cells.size() << " cells. \n";}
-            iteration = 1;
+        if(udt) {
+            Gillespie::gillespieUDT(ctx, until);
+        } else {
+            Gillespie::gillespieIA(ctx, until, p.wt_dr, p.u, p.du, p.s, p.tr);
+        }
+        record_history(ctx);
+        check_stop(ctx);
+        checkpoints.step(ctx, p);
+        if(progress.due()) {
+            checkpoints.poll(ctx, p);
+            progress.poll(ctx, ctx.cells.size(), ctx.stats.events, target);
         }
     }
+}
 
-    if(recurrent_size > 0) {
-        if(verbose) {
-            Rcpp::Rcout << "Simulating treatment ... ... \n";
+static void grow(SimContext &ctx, const SimParams &p, const bool udt, const int target, const double until,
+                 Checkpointer &checkpoints, Progress &progress) {
+    //with several threads the tumor is grown in parallel once it is large enough to be split (infinite alleles only)
+    if(!udt && p.nthreads > 1) {
+        grow_serial(ctx, p, udt, std::min(target, PARALLEL_MIN_CELLS*p.nthreads), until, checkpoints, progress);
+        Parallel::growIA(ctx, p, target, until, checkpoints, progress);
+    }
+    grow_serial(ctx, p, udt, target, until, checkpoints, progress);
+}
+
+//Grow the tumor and give it the doses of therapy, each once its size or time is reached, then let it grow back.
+//ctx.phase counts the doses given, so a simulation resumed from a snapshot picks up where it was
+static void grow_and_treat(SimContext &ctx, const SimParams &p, const bool udt, double &start,
+                           Checkpointer &checkpoints, Progress &progress) {
+    const std::vector<Dose> doses = SimUtils::schedule(p);
+    const int final_size = doses.empty() || p.recurrent_size <= 0 ? p.tumor_size : p.recurrent_size;
+
+    while(ctx.phase < doses.size()) {
+        const Dose &dose = doses[ctx.phase];
+        //the time of a dose counts from the previous dose. The clock stops at until, so a dose that is given on time
+        //is recorded at exactly its scheduled time, and the times of later doses do not drift
+        const double until = (ctx.doses.empty() ? 0 : ctx.doses.back().time) + dose.time;
+        grow(ctx, p, udt, (int)std::min((double)p.tumor_size, dose.size), until, checkpoints, progress);
+        note_memory(ctx);
+        //the tumor reached max_pop before the dose was due, write_output reports the doses that were not given
+        if(ctx.cells.empty() || !ctx.stopped.empty() || (ctx.cells.size() < dose.size && ctx.time < until)) {return;}
+
+        const double treated = wall_seconds();
+        ctx.stats.growth_seconds += treated - start;
+        if(p.verbose) {
+            Rcpp::Rcout << "Simulating treatment (dose " << ctx.phase + 1 << ") at " << ctx.cells.size() << " cells ... ... \n";
         }
-        int i = 0; 
-        while(i < cells.size()) {
-            if(!species[cells[i].id].treatment_resistance) {
-                cell cell = cells[i];
-                //Free up the space in the lattice
-                lattice[cell.x][cell.y][cell.z] = 0;
-                //remove cell from list
-                std::swap(cells[i], cells.back());
-                cells.pop_back();   
-                --species[cell.id].count;    
-            } else {
-                ++i;
-            }
+        //the history shows the tumor right before and right after treatment
+        record_history(ctx, true);
+        Therapy::apply(ctx, p, dose);
+        ++ctx.phase;
+        record_history(ctx, true);
+        ctx.stop_rule.reset(ctx.species, ctx.species.size());
+        check_stop(ctx);
+        start = wall_seconds();
+        ctx.stats.treatment_seconds += start - treated;
+
+        if(ctx.cells.empty() && p.verbose) {
+            Rcpp::Rcout << "No cells survived treatment. \n";
         }
-
-        while(cells.size() < recurrent_size)
-        {
-            index = selectIndexRS(cells, species);
-            Gillespie::gillespieIA(cells, species, index, time, wt_dr, u, du, s, tr);
-            ++iteration;
-            if(iteration % interval == 0)
-            {
-                if(verbose) {Rcpp::Rcout << "Simulated time: " << time << " days. Population is " << cells.size() << " cells. \n";}
-                iteration = 1;
-            }
-        }   
     }
+    grow(ctx, p, udt, final_size, HUGE_VAL, checkpoints, progress);
+}
 
-    //Print summary of simulation
-    if(verbose) {Rcpp::Rcout << "Simulation complete. Releasing memory ... ... \n";}
-    SimUtils::trashcan(lattice);   
-
-    if(verbose) {Rcpp::Rcout << "Simulated time is " << time << " days \n";}
-
-    end = clock();
-    if(verbose) {Rcpp::Rcout << "Simulation completed in " << (double)(end - start)/CLOCKS_PER_SEC << " s.\n";}
-    if(verbose) {Rcpp::Rcout << "Writing results ... ... \n";}
+void Sims::simulate(SimContext &ctx, const SimParams &p, const bool udt) {
+    std::vector<cell> &cells = ctx.cells;
+    std::vector<specie> &species = ctx.species;
+    const bool verbose = p.verbose;
+    const size_t nspecies = species.size();
 
-    //save the data and write them to R objects 
-    Rcpp::NumericMatrix cell_coords(cells.size(), 7);
+    //start clock
+    double start = wall_seconds();
 
-    int maximum_mut = max_mut(species);
-    Rcpp::IntegerMatrix species_dict(species.size(), maximum_mut+1); 
+    //snapshots of the simulation, if they were asked for
+    Checkpointer checkpoints(p);
+    Progress progress(ctx, p);
+    ctx.stop_rule.reset(species, species.size());
 
-    Rcpp::IntegerVector muts(total_mutations+1);
-    PostProcessing::write_results(cells, species, cell_coords, species_dict, muts);
+    //main simulation loop
+    grow_and_treat(ctx, p, udt, start, checkpoints, progress);
+
+    record_history(ctx, true);
+    checkpoints.finish(ctx, p);
+    note_memory(ctx);
+    ctx.stats.growth_seconds += wall_seconds() - start;
+    ctx.stats.new_species += species.size() - nspecies;
+    ctx.stats.add_sampler(ctx.birth_sampler);
+    if(udt) {
+        ctx.stats.genotype_lookups += ctx.genotype_index.lookups();
+        ctx.stats.genotype_cache_hits += ctx.genotype_index.hits();
+    }
 
-    Rcpp::IntegerVector driver_muts = Rcpp::wrap(drivers);
+    //Print summary of simulation
+    if(verbose && !ctx.stopped.empty()) {
+        Rcpp::Rcout << "Simulation stopped (" << ctx.stopped << ") at " << cells.size() << " cells. \n";
+    }
+    if(verbose) {Rcpp::Rcout << "Simulation complete. Releasing memory ... ... \n";}
+    SimUtils::trashcan(ctx.lattice);   
 
-    Rcpp::IntegerMatrix rphylo_tree(phylo_tree[0].size(), 2);
-    PostProcessing::write_phylo_tree(phylo_tree, rphylo_tree);
+    if(verbose) {Rcpp::Rcout << "Simulated time is " << ctx.time << " days \n";}
+    if(verbose) {
+        Rcpp::Rcout << "Birth sampler acceptance rate is " << ctx.birth_sampler.acceptance() 
+                    << " (plain rejection sampling: " << ctx.birth_sampler.uniform_acceptance() << ") \n";
+    }
 
-    Rcpp::NumericMatrix color_scheme = PostProcessing::get_color_scheme(species);
+    if(verbose) {
+        Rcpp::Rcout << "Simulation completed in " << ctx.stats.growth_seconds + ctx.stats.treatment_seconds << " s.\n";
+    }
+}
 
-    //create list 
+//the columns of the recorded history
+static Rcpp::List write_history(const Recorder &history) {
     Rcpp::List out = Rcpp::List::create();
-    out.push_back(cell_coords);
-    out.push_back(species_dict);
-    out.push_back(muts);
-    out.push_back(rphylo_tree);
-    out.push_back(color_scheme);
-    out.push_back(species.size());
-    out.push_back(driver_muts);
-    out.push_back(time);
-    return(out);
+    out.push_back(Rcpp::wrap(history.time), "time");
+    out.push_back(Rcpp::wrap(history.cells), "cells");
+    out.push_back(Rcpp::wrap(history.alleles), "alleles");
+    out.push_back(Rcpp::wrap(history.driver_cells), "driver_cells");
+    out.push_back(Rcpp::wrap(history.resistant), "resistant_fraction");
+    out.push_back(Rcpp::wrap(history.clone_record), "clone_record");
+    out.push_back(Rcpp::wrap(history.clone_allele), "clone_allele");
+    out.push_back(Rcpp::wrap(history.clone_count), "clone_count");
+    return out;
 }
 
-Rcpp::List Sims::simulateUDT(Rcpp::List input) {
-    //Read input list (from R)
-    std::vector<double> params = input["params"]; 
-    int tumor_size = params[0]; 
-    double wt_br = params[1]; 
-    double wt_dr = params[2]; 
-    bool verbose = params[3];
-
-    //Init time 
-    double time = 0; 
-
-    //initialize vector of cells:
-    std::vector<cell> cells; 
-    std::vector<specie> species;
-    cells.push_back(SimUtils::initial_cell(species, wt_br, wt_dr));
-
-    int index;
-    int iteration = 1;
-
-    //start clock
-    clock_t start, end; 
-    start = clock();
-
-    //main simulation loop
-    while(cells.size() < tumor_size)
-    {
-        index = selectIndexRS(cells, species);
-        Gillespie::gillespieUDT(cells, species, index, time);
-        ++iteration;
-        if(iteration % interval == 0)
-        {
-            if(verbose) {Rcpp::Rcout << "Simulated time: " << time << " days. Population is " << cells.size() << " cells. \n";}
-            iteration = 1;
-        }
+//the columns of the record of therapy, one row per dose
+static Rcpp::List write_doses(const std::vector<DoseRecord> &doses) {
+    const int n = doses.size();
+    Rcpp::NumericVector time(n), cells_before(n), cells_after(n), resistant_before(n), resistant_after(n);
+    Rcpp::IntegerVector alleles_before(n), alleles_after(n);
+    for(int k = 0; k < n; ++k) {
+        time[k] = doses[k].time;
+        cells_before[k] = doses[k].cells_before;
+        cells_after[k] = doses[k].cells_after;
+        alleles_before[k] = doses[k].alleles_before;
+        alleles_after[k] = doses[k].alleles_after;
+        resistant_before[k] = doses[k].resistant_before;
+        resistant_after[k] = doses[k].resistant_after;
     }
+    Rcpp::List out = Rcpp::List::create();
+    out.push_back(time, "time");
+    out.push_back(cells_before, "cells_before");
+    out.push_back(cells_after, "cells_after");
+    out.push_back(alleles_before, "alleles_before");
+    out.push_back(alleles_after, "alleles_after");
+    out.push_back(resistant_before, "resistant_before");
+    out.push_back(resistant_after, "resistant_after");
+    return out;
+}
 
-    //Print summary of simulation
-    if(verbose) {Rcpp::Rcout << "Simulation complete. Releasing memory ... ... \n";}
-    SimUtils::trashcan(lattice);   
-
-    if(verbose) {Rcpp::Rcout << "Simulated time is " << time << " days \n";}
+//the counters of the run
+static Rcpp::List write_stats(const RunStats &stats) {
+    Rcpp::List out = Rcpp::List::create();
+    out.push_back(stats.events, "events");
+    out.push_back(stats.births, "births");
+    out.push_back(stats.deaths, "deaths");
+    out.push_back(stats.skipped_deaths, "skipped_deaths");
+    out.push_back(stats.birth_draws, "birth_draws");
+    out.push_back(stats.birth_rejections, "birth_rejections");
+    out.push_back(stats.death_draws - stats.deaths - stats.skipped_deaths, "death_rejections");
+    out.push_back(stats.dropped_daughters, "dropped_daughters");
+    out.push_back(stats.new_species, "new_species");
+    out.push_back(stats.max_rate_raises, "max_rate_raises");
+    out.push_back(stats.genotype_lookups, "genotype_lookups");
+    out.push_back(stats.genotype_cache_hits, "genotype_cache_hits");
+    out.push_back(stats.init_seconds, "init_seconds");
+    out.push_back(stats.growth_seconds, "growth_seconds");
+    out.push_back(stats.treatment_seconds, "treatment_seconds");
+    out.push_back(stats.output_seconds, "output_seconds");
+    out.push_back(stats.lattice_bytes, "lattice_bytes");
+    out.push_back(stats.cell_bytes, "cell_bytes");
+    out.push_back(stats.species_bytes, "species_bytes");
+    return out;
+}
 
-    end = clock();
-    if(verbose) {Rcpp::Rcout << "Simulation completed in " << (double)(end - start)/CLOCKS_PER_SEC << " s.\n";}
-    if(verbose) {Rcpp::Rcout << "Writing results ... ... \n";}
+Rcpp::List Sims::write_output(SimContext &ctx, const SimParams &p, const bool udt) {
+    const double start = wall_seconds();
+    std::vector<cell> &cells = ctx.cells;
+    std::vector<specie> &species = ctx.species;
 
-    //save the data and write them to R objects 
-    Rcpp::NumericMatrix cell_coords(cells.size(), 6);
+    if(p.verbose) {Rcpp::Rcout << "Writing results ... ... \n";}
 
-    int maximum_mut = max_mut(species);
-    Rcpp::IntegerMatrix species_dict(species.size(), maximum_mut+1); 
+    //save the data and write them to R objects, or stream the cells to a file
+    Rcpp::List cell_ids = Rcpp::List::create();
+    if(p.cell_file.empty()) {
+        cell_ids = PostProcessing::write_results(cells, species, p.nthreads);
+    } else {
+        CellFile::write(cells, species, p.cell_file);
+    }
 
-    Rcpp::IntegerVector muts(maximum_mut);
-    PostProcessing::write_results(cells, species, cell_coords, species_dict, muts);
+    //under a disease model the mutations are the states of the model
+    Rcpp::IntegerVector muts(udt ? ctx.G.size() : ctx.total_mutations+1);
+    PostProcessing::count_mutations(species, muts.begin(), p.nthreads);
 
-    Rcpp::IntegerVector driver_muts = Rcpp::wrap(drivers);
+    Rcpp::IntegerVector driver_muts = Rcpp::wrap(ctx.drivers);
 
     Rcpp::IntegerMatrix rphylo_tree(1,2);
+    if(!udt) {
+        rphylo_tree = Rcpp::IntegerMatrix(ctx.phylo_tree[0].size(), 2);
+        PostProcessing::write_phylo_tree(ctx.phylo_tree, rphylo_tree);
+    }
 
     Rcpp::NumericMatrix color_scheme = PostProcessing::get_color_scheme(species);
 
     //create list 
     Rcpp::List out = Rcpp::List::create();
-    out.push_back(cell_coords);
-    out.push_back(species_dict);
+    out.push_back(cell_ids);
+    if(p.csr) {
+        //genotypes as offsets into one vector of mutations
+        out.push_back(PostProcessing::write_species_csr(species));
+    } else {
+        //genotypes padded with -1 to the longest genotype
+        Rcpp::IntegerMatrix species_dict(species.size(), max_mut(species)+1); 
+        PostProcessing::write_species_dict(species, species_dict);
+        out.push_back(species_dict);
+    }
     out.push_back(muts);
     out.push_back(rphylo_tree);
     out.push_back(color_scheme);
     out.push_back(species.size());
     out.push_back(driver_muts);
-    out.push_back(time);
-    return(out);    
+    out.push_back(ctx.time);
+    if(ctx.history.active()) {
+        out.push_back(write_history(ctx.history), "history");
+    }
+    if(!ctx.doses.empty()) {
+        out.push_back(write_doses(ctx.doses), "therapy");
+    }
+    if(!ctx.stopped.empty()) {
+        out.push_back(ctx.stopped, "stopped");
+    }
+    //a living tumor that was not stopped only misses doses when it reached max_pop before they were due
+    const int skipped = (int)SimUtils::schedule(p).size() - ctx.phase;
+    if(skipped > 0 && !ctx.cells.empty() && ctx.stopped.empty()) {
+        out.push_back(skipped, "skipped_doses");
+    }
+    if(p.stats) {
+        ctx.stats.output_seconds += wall_seconds() - start;
+        out.push_back(write_stats(ctx.stats), "stats");
+    }
+    return(out);
+}
+
+//Set up the replicates in ctxs from the next streams of the seed (on the main thread), then simulate them on the
+//worker threads, which never call into R. If spec is given, the replicates are also summarized on the worker
+//threads (into rows) and their tumors are released
+static void run_block(Rcpp::List input, const bool udt, const int nthreads, const int first, Xoshiro256 &stream,
+                      std::vector<SimContext> &ctxs, std::vector<SimParams> &params,
+                      const SummarySpec *spec, std::vector<std::vector<double> > &rows) {
+    const int n = ctxs.size();
+    for(int i = 0; i < n; ++i) {
+        params[i] = udt ? SimUtils::initUDT(ctxs[i], input) : SimUtils::initIA(ctxs[i], input);
+        //the replicates themselves are the parallel work
+        params[i].verbose = false;
+        params[i].nthreads = 1;
+        params[i].progress_callback = R_NilValue;
+        params[i].interruptible = false;
+        ctxs[i].rng.seed(stream);
+        stream.jump();
+    }
+
+    std::vector<std::string> errors(n);
+    #pragma omp parallel for schedule(dynamic) num_threads(nthreads)
+    for(int i = 0; i < n; ++i) {
+        //exceptions can not leave the parallel region, so they are reported after it
+        try {
+            Sims::simulate(ctxs[i], params[i], udt);
+            if(spec != NULL) {
+                rows[i] = Summaries::compute(ctxs[i], *spec);
+                std::vector<cell>().swap(ctxs[i].cells);
+                std::vector<specie>().swap(ctxs[i].species);
+            }
+        } catch(std::exception &e) {
+            errors[i] = e.what();
+        } catch(...) {
+            errors[i] = "unknown error";
+        }
+    }
+
+    for(int i = 0; i < n; ++i) {
+        if(!errors[i].empty()) {
+            Rcpp::stop("Replicate " + std::to_string(first + i + 1) + " failed: " + errors[i]);
+        }
+    }
+}
+
+Rcpp::List Sims::simulateBatch(Rcpp::List input) {
+    const int nreps = input["nreps"];
+    const int nthreads = input["nthreads"];
+    const double seed = input["seed"];
+    const bool udt = input.containsElementNamed("G");
+
+    //replicate k uses stream k of the seed, which does not depend on the number of threads
+    Xoshiro256 stream;
+    stream.seed((uint64_t)seed);
+
+    Rcpp::List out(nreps);
+
+    //Replicates are run in blocks. Each block is set up and written to R objects on the main thread,
+    //and only the simulations in between run on the worker threads.
+    //A few replicates per thread keep the threads busy while holding a bounded number of tumors in memory
+    const int block = 4*nthreads;
+    for(int first = 0; first < nreps; first += block) {
+        const int n = std::min(block, nreps - first);
+        std::vector<SimContext> ctxs(n);
+        std::vector<SimParams> params(n);
+        std::vector<std::vector<double> > rows;
+        run_block(input, udt, nthreads, first, stream, ctxs, params, NULL, rows);
+        for(int i = 0; i < n; ++i) {
+            out[first + i] = Sims::write_output(ctxs[i], params[i], udt);
+        }
+    }
+    return out;
+}
+
+Rcpp::NumericMatrix Sims::simulateSummaries(Rcpp::List input) {
+    const int nreps = input["nreps"];
+    const int nthreads = input["nthreads"];
+    const double seed = input["seed"];
+    const bool udt = input.containsElementNamed("G");
+    const SummarySpec spec = Summaries::read(input);
+    const Rcpp::CharacterVector names = Summaries::names(spec);
+
+    //the same streams as simulateBatch, so row k summarizes replicate k of the batch
+    Xoshiro256 stream;
+    stream.seed((uint64_t)seed);
+
+    Rcpp::NumericMatrix out(nreps, names.size());
+    const int block = 4*nthreads;
+    for(int first = 0; first < nreps; first += block) {
+        const int n = std::min(block, nreps - first);
+        std::vector<SimContext> ctxs(n);
+        std::vector<SimParams> params(n);
+        std::vector<std::vector<double> > rows(n);
+        run_block(input, udt, nthreads, first, stream, ctxs, params, &spec, rows);
+        for(int i = 0; i < n; ++i) {
+            for(int j = 0; j < rows[i].size(); ++j) {out(first + i, j) = rows[i][j];}
+        }
+    }
+    Rcpp::colnames(out) = names;
+    return out;
 }
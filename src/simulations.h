@@ -1,18 +1,32 @@
+
+
 #ifndef SIMULATIONS_H
 #define SIMULATIONS_H
 
 #include"simutils.h"
-#include"sampler.h"
+#include"context.h"
 #include"gillespie.h"
 #include"postproc.h"
+#include"parallel.h"
+#include"checkpoint.h"
+#include"cellfile.h"
+#include"progress.h"
+#include"summaries.h"
+#include"therapy.h"
 
-extern std::vector<int> drivers; 
+namespace Sims {
+    //grow the tumor held in ctx (set up by SimUtils::initIA, or SimUtils::initUDT if udt is set)
+    //nothing here calls into R unless p.verbose is set or ctx draws from R's generator
+    void simulate(SimContext &ctx, const SimParams &p, const bool udt);
 
-extern bool*** lattice; 
+    //write the simulated tumor to R objects 
+    Rcpp::List write_output(SimContext &ctx, const SimParams &p, const bool udt);
 
-namespace Sims {
-    Rcpp::List simulateIA(Rcpp::List input); 
-    Rcpp::List simulateUDT(Rcpp::List input);
+    //independent replicates, simulated in parallel
+    Rcpp::List simulateBatch(Rcpp::List input);
+
+    //summary statistics of independent replicates (see summaries.h), one row per replicate
+    Rcpp::NumericMatrix simulateSummaries(Rcpp::List input);
 }
 
 
@@ -21,4 +35,4 @@ namespace Sims {
 
 
 
-#endif 
\ No newline at end of file
+#endif 
@@ -1,74 +1,268 @@
 #include"simutils.h"
+#include"context.h"
+#include"checkpoint.h"
+#include"neighbors.h"
+
+//options of a run that are not part of the model
+static void read_options(SimParams &p, SimContext &ctx, Rcpp::List input) {
+    p.csr = input.containsElementNamed("csr");
+    p.stats = input.containsElementNamed("stats");
+    p.nthreads = 1;
+    if(input.containsElementNamed("nthreads")) {
+        p.nthreads = input["nthreads"];
+    }
+    p.checkpoint = "";
+    p.checkpoint_sizes.clear();
+    p.checkpoint_every = 0;
+    if(input.containsElementNamed("checkpoint")) {
+        p.checkpoint = Rcpp::as<std::string>(input["checkpoint"]);
+        if(input.containsElementNamed("checkpoint_at")) {
+            p.checkpoint_sizes = Rcpp::as<std::vector<double> >(input["checkpoint_at"]);
+            std::sort(p.checkpoint_sizes.begin(), p.checkpoint_sizes.end());
+        }
+        if(input.containsElementNamed("checkpoint_every")) {
+            p.checkpoint_every = input["checkpoint_every"];
+        }
+    }
 
-double p_max;
-std::vector<int> drivers; 
-int total_mutations;
-int x_dim, y_dim, z_dim; //Size of the lattice (set at the start of simulation to accomodate num of cells)
+    p.cell_file = "";
+    if(input.containsElementNamed("cell_file")) {
+        p.cell_file = Rcpp::as<std::string>(input["cell_file"]);
+    }
 
-bool*** lattice; 
-std::vector<std::vector<int> > phylo_tree(2, std::vector<int>());
-std::vector<std::vector<int> > perms;
-std::vector<std::vector<Edge> > G; 
+    p.max_wall_seconds = 0;
+    if(input.containsElementNamed("max_wall_seconds")) {
+        p.max_wall_seconds = input["max_wall_seconds"];
+    }
+    p.progress_every = 0;
+    p.progress_callback = R_NilValue;
+    if(input.containsElementNamed("progress_every")) {
+        p.progress_every = input["progress_every"];
+    }
+    if(input.containsElementNamed("progress")) {
+        p.progress_callback = input["progress"];
+    }
+    p.interruptible = true;
 
-void SimUtils::initIA(Rcpp::List input) {
-    //Read input list (from R)
-    std::vector<double> params = input["params"]; 
-    int tumor_size = params[0]; 
-    double wt_br = params[1]; 
-    double wt_dr = params[2]; 
-    double u = params[3]; 
-    double du = params[4]; 
-    double s = params[5]; 
-    bool verbose = params[6];
-    double treatment_time = params[7];
-    double recurrent_size = params[8];
+    std::vector<double> record_times, record_sizes;
+    if(input.containsElementNamed("record_times")) {
+        record_times = Rcpp::as<std::vector<double> >(input["record_times"]);
+    }
+    if(input.containsElementNamed("record_sizes")) {
+        record_sizes = Rcpp::as<std::vector<double> >(input["record_sizes"]);
+    }
+    ctx.history.init(record_times, record_sizes);
+
+    //the conditions that are not given are never met
+    double stop_time = HUGE_VAL, clone_freq = HUGE_VAL, resistant_fraction = HUGE_VAL;
+    int drivers = INT_MAX;
+    bool extinction = false, all = false;
+    if(input.containsElementNamed("stop_when")) {
+        Rcpp::List stop_when = input["stop_when"];
+        if(stop_when.containsElementNamed("time")) {stop_time = stop_when["time"];}
+        if(stop_when.containsElementNamed("clone_freq")) {clone_freq = stop_when["clone_freq"];}
+        if(stop_when.containsElementNamed("drivers")) {drivers = stop_when["drivers"];}
+        if(stop_when.containsElementNamed("resistant_fraction")) {resistant_fraction = stop_when["resistant_fraction"];}
+        extinction = stop_when["extinction"];
+        all = stop_when["all"];
+    }
+    ctx.stop_rule.init(stop_time, clone_freq, drivers, resistant_fraction, extinction, all);
+
+    //a schedule given here replaces the one of a snapshot
+    if(input.containsElementNamed("therapy")) {
+        Rcpp::List therapy = input["therapy"];
+        std::vector<double> size = Rcpp::as<std::vector<double> >(therapy["size"]);
+        std::vector<double> time = Rcpp::as<std::vector<double> >(therapy["time"]);
+        std::vector<double> kill = Rcpp::as<std::vector<double> >(therapy["kill"]);
+        std::vector<double> kill_resistant = Rcpp::as<std::vector<double> >(therapy["kill_resistant"]);
+        p.therapy.clear();
+        for(int k = 0; k < size.size(); ++k) {
+            Dose dose = {size[k], time[k], kill[k], kill_resistant[k]};
+            p.therapy.push_back(dose);
+        }
+        p.resistant_states = Rcpp::as<std::vector<int> >(therapy["resistant_states"]);
+        std::sort(p.resistant_states.begin(), p.resistant_states.end());
+    }
 
-    if(verbose) {Rcpp::Rcout << "Initializing structures ... ...\n";}
+    //R's generator can not be called from other threads, and its state can not be saved
+    if(p.nthreads > 1 && !ctx.rng.is_native()) {
+        Rcpp::stop("A seed is required to simulate with more than one thread.");
+    }
+    if(!p.checkpoint.empty() && !ctx.rng.is_native()) {
+        Rcpp::stop("A seed is required to write checkpoints.");
+    }
+}
 
-    //Initialize global variables
-    gv_init(tumor_size, wt_br, wt_dr, u, du, s);
+SimParams SimUtils::initIA(SimContext &ctx, Rcpp::List input) {
+    const double start = wall_seconds();
+    //Read input list (from R)
+    std::vector<double> params = input["params"]; 
+    SimParams p;
+    p.tumor_size = params[0]; 
+    p.wt_br = params[1]; 
+    p.wt_dr = params[2]; 
+    p.u = params[3]; 
+    p.du = params[4]; 
+    p.s = params[5]; 
+    p.verbose = params[6];
+    p.recurrent_size = params[7];
+    p.tr = params[8];
+
+    if(p.verbose) {Rcpp::Rcout << "Initializing structures ... ...\n";}
+
+    //Use the in-package generator if a seed was given
+    ctx.rng.init(input);
+    read_options(p, ctx, input);
+
+    //Initialize the state of the simulation
+    gv_init(ctx, p.tumor_size, p.wt_br, p.wt_dr, p.u, p.du, p.s);
 
     //initialize empty lattice 
-    lattice = init_lattice();
+    init_lattice(ctx.lattice);
 
-    std::vector<int> v;
-    v.push_back(1); v.push_back(2); v.push_back(3); v.push_back(4); v.push_back(5); v.push_back(6);
-    perms = get_perms(v);
+    //the tumor starts from a single cell, all of its neighbors are free
+    ctx.cells.push_back(SimUtils::initial_cell(ctx.species, p.wt_br, p.wt_dr));
+    add_boundary(ctx, 0);
+    ctx.stats.init_seconds = wall_seconds() - start;
+    return p;
 }
 
-void SimUtils::initUDT(Rcpp::List input) {
+SimParams SimUtils::initUDT(SimContext &ctx, Rcpp::List input) {
+    const double start = wall_seconds();
     //Read input list (from R)
     std::vector<double> params = input["params"]; 
-    int tumor_size = params[0]; 
-    double wt_br = params[1]; 
-    double wt_dr = params[2]; 
-    bool verbose = params[3];
+    SimParams p;
+    p.tumor_size = params[0]; 
+    p.wt_br = params[1]; 
+    p.wt_dr = params[2]; 
+    p.u = 0.0;
+    p.du = 0.0;
+    p.s = 1.0;
+    p.verbose = params[3];
+    p.recurrent_size = 0;
+    p.tr = 0.0;
 
     Rcpp::NumericMatrix Gv = input["G"];
 
-    if(verbose) {Rcpp::Rcout << "Initializing structures ... ...\n";}
+    if(p.verbose) {Rcpp::Rcout << "Initializing structures ... ...\n";}
 
-    //Initialize global variables
-    gv_init(tumor_size, wt_br, wt_dr, 0.0, 0.0, 1.0);
+    //Use the in-package generator if a seed was given
+    ctx.rng.init(input);
+    read_options(p, ctx, input);
+    //the parallel engine only supports infinite alleles
+    p.nthreads = 1;
+    if(ctx.stop_rule.drivers()) {
+        Rcpp::stop("There are no driver mutations under a disease model.");
+    }
 
-    //initialize empty lattice 
-    lattice = init_lattice();
+    //Initialize the state of the simulation
+    gv_init(ctx, p.tumor_size, p.wt_br, p.wt_dr, p.u, p.du, p.s);
 
-    std::vector<int> v;
-    v.push_back(1); v.push_back(2); v.push_back(3); v.push_back(4); v.push_back(5); v.push_back(6);
-    perms = get_perms(v);
+    //initialize empty lattice 
+    init_lattice(ctx.lattice);
 
     //Process G
-    G = processG(Gv);       
+    ctx.G = processG(Gv);       
+
+    //the tumor starts from a single cell, all of its neighbors are free
+    ctx.cells.push_back(SimUtils::initial_cell(ctx.species, p.wt_br, p.wt_dr));
+    add_boundary(ctx, 0);
+    ctx.genotype_index.init(ctx.species, ctx.G.size(), p.resistant_states);
+    ctx.stats.init_seconds = wall_seconds() - start;
+    return p;
+}
+
+SimParams SimUtils::initResume(SimContext &ctx, Rcpp::List input) {
+    const double start = wall_seconds();
+    const std::string path = Rcpp::as<std::string>(input["snapshot"]);
+    SimParams p = Checkpoint::read(ctx, path);
+    const bool udt = !ctx.G.empty();
+    p.verbose = input["verbose"];
+    read_options(p, ctx, input);
+    if(udt) {p.nthreads = 1;}
+
+    //the size of the tumor and the treatment can be changed, the rest of the model can not
+    if(input.containsElementNamed("max_pop")) {
+        p.tumor_size = input["max_pop"];
+    }
+    if(input.containsElementNamed("recurrent_size")) {
+        p.recurrent_size = input["recurrent_size"];
+    }
+    if(input.containsElementNamed("resistance_prob")) {
+        p.tr = input["resistance_prob"];
+    }
+    if(ctx.phase == 0 && ctx.cells.size() > p.tumor_size) {
+        Rcpp::stop("max_pop is smaller than the tumor in the snapshot.");
+    }
+    if(udt && ctx.stop_rule.drivers()) {
+        Rcpp::stop("There are no driver mutations under a disease model.");
+    }
+    //the schedule may come with other resistant states
+    if(udt) {ctx.genotype_index.init(ctx.species, ctx.G.size(), p.resistant_states);}
+
+    if(p.verbose) {
+        Rcpp::Rcout << "Resuming from " << ctx.cells.size() << " cells at time " << ctx.time << " days. \n";
+    }
+    //the stats count this call only, not the draws made before the snapshot
+    ctx.stats.add_sampler(ctx.birth_sampler, -1);
+    ctx.stats.init_seconds = wall_seconds() - start;
+    return p;
+}
+
+//the parameters of a simulation as passed in from R
+Rcpp::NumericVector SimUtils::params_vector(const SimParams &p, const bool udt) {
+    if(udt) {
+        return Rcpp::NumericVector::create(p.tumor_size, p.wt_br, p.wt_dr, p.verbose);
+    }
+    return Rcpp::NumericVector::create(p.tumor_size, p.wt_br, p.wt_dr, p.u, p.du, p.s, p.verbose,
+                                       p.recurrent_size, p.tr);
+}
+
+std::vector<Dose> SimUtils::schedule(const SimParams &p) {
+    if(p.therapy.empty() && p.recurrent_size > 0) {
+        //every sensitive cell dies once the tumor has grown to its size
+        Dose dose = {(double)p.tumor_size, HUGE_VAL, 1, 0};
+        return std::vector<Dose>(1, dose);
+    }
+    return p.therapy;
+}
+
+void SimUtils::rebuild_channels(SimContext &ctx, const int nthreads) {
+    std::vector<cell> &cells = ctx.cells;
+    Lattice &lattice = ctx.lattice;
+    const int n = cells.size();
+
+    //every thread only writes to the sites of its own cells, and no chunk is allocated or freed
+    #pragma omp parallel for schedule(static) num_threads(nthreads)
+    for(int i = 0; i < n; ++i) {
+        cell &c = cells[i];
+        lattice.reindex(c.x, c.y, c.z, i);
+        unsigned char nfree = 0;
+        for(int key = 1; key <= 6; ++key) {
+            if(free_neighbor(c, lattice, key)) {++nfree;}
+        }
+        lattice.nfree(c.x, c.y, c.z) = nfree;
+        c.bucket = -1;
+    }
+
+    ctx.birth_sampler.clear();
+    ctx.uniform = false;
+    ctx.total_death_rate = 0;
+    for(int i = 0; i < n; ++i) {
+        if(lattice.nfree(cells[i].x, cells[i].y, cells[i].z) > 0) {
+            add_boundary(ctx, i);
+        }
+        ctx.total_death_rate += ctx.species[cells[i].id].d;
+    }
 }
 
 cell SimUtils::initial_cell(std::vector<specie> &species, double wt_br, double wt_dr)
 {
-    //Initial cell lies in the center of the lattice
+    //Initial cell lies at the origin of the lattice
     cell cell;
-    cell.x = x_dim/2;
-    cell.y = y_dim/2;
-    cell.z = z_dim/2;
+    cell.x = 0;
+    cell.y = 0;
+    cell.z = 0;
 
     //initial specie type has wild type birth and death rates
     specie initial_type;
@@ -76,7 +270,9 @@ cell SimUtils::initial_cell(std::vector<specie> &species, double wt_br, double w
     initial_type.d = wt_dr;
     initial_type.id = 0;
     initial_type.count = 1;
+    initial_type.parent = -1;
     initial_type.genotype.push_back(0);
+    initial_type.nmuts = 1;
     initial_type.treatment_resistance = false;
 
     //color
@@ -92,50 +288,38 @@ cell SimUtils::initial_cell(std::vector<specie> &species, double wt_br, double w
     return cell;
 }
 
-void SimUtils::trashcan(bool*** lattice)
+void SimUtils::trashcan(Lattice &lattice)
 {
     // deallocate
-    for(int i = 0; i < x_dim; ++i)
-    {
-        for(int j = 0; j < y_dim; ++j)
-        {
-            delete[] lattice[i][j];
-        } 
-        delete[] lattice[i];
-    }
-    delete[] lattice;
+    lattice.release();
 }
 
-bool*** init_lattice()
+void init_lattice(Lattice &lattice)
 {
-    bool*** lattice = new bool**[x_dim];
-    for(int i = 0; i < x_dim; ++i)
-    {
-        lattice[i] = new bool*[y_dim];
-        for(int j = 0; j < y_dim; ++j)
-        {
-            lattice[i][j] = new bool[z_dim];
-        }
-    }
-    //Initialize all zeros
-    for(int i = 0; i < x_dim; ++i)
-    {
-        for(int j = 0; j < y_dim; ++j)
-        {
-            for(int k = 0; k < z_dim; ++k)
-            {
-                lattice[i][j][k] = 0;
-            }
-        }
-    }
-    lattice[x_dim/2][y_dim/2][z_dim/2] = 1;
-    return lattice;
+    //Lattice starts empty except for the initial cell
+    lattice.init();
+    lattice.set(0, 0, 0, 0);
+    lattice.nfree(0, 0, 0) = 6;
 }
 
-void gv_init(const int N, const double wt_br, const double wt_dr, const double u, const double du, const double s) {
-    total_mutations = 0; 
-    drivers.clear(); 
-    p_max = wt_br + wt_dr;
+void gv_init(SimContext &ctx, const int N, const double wt_br, const double wt_dr, const double u, const double du, const double s) {
+    ctx.cells.clear();
+    ctx.species.clear();
+    ctx.time = 0;
+    ctx.phase = 0;
+    ctx.total_mutations = 0; 
+    ctx.drivers.clear(); 
+    ctx.doses.clear();
+    ctx.phylo_tree.assign(2, std::vector<int>());
+    ctx.d_max = wt_dr;
+    ctx.total_death_rate = wt_dr;
+    ctx.birth_sampler.clear();
+    ctx.uniform = false;
+    ctx.b_max = wt_br;
+    ctx.window_draws = 0;
+    ctx.window_events = 0;
+    //the selection is chosen at the first draw
+    ctx.window_size = 0;
 
     //error checking 
     if(N < 1) {Rcpp::stop("N must be at least 2.");}
@@ -144,20 +328,6 @@ void gv_init(const int N, const double wt_br, const double wt_dr, const double u
     if(u < 0) {Rcpp::stop("u must be non-negative");}
     if(du < 0.0 || du > 1.0) {Rcpp::stop("du must be in [0,1]");}
     if(s < 0) {Rcpp::stop("s must be non-negative");}
-
-    //set lattice dims 
-    if(N > 100000000) {
-        //very large lattice dims
-        x_dim = 2000; y_dim = 2000; z_dim = 2000;
-    }
-    else if(N > 10000000) {
-        //decently large
-        x_dim = 1000; y_dim = 1000; z_dim = 1000;
-    }
-    else {
-        //This should handle most cases
-        x_dim = 500; y_dim = 500; z_dim = 500;
-    }
 }
 
 //Store all permutations 
@@ -10,26 +10,35 @@
 #include<float.h> 
 #include<string> 
 #include<Rcpp.h> 
-
-//How often to print to screen
-#define interval 2000000
+#include"lattice.h"
+#include"rng.h"
 
 //**** Structs for simulations ****// 
 //Defined types for simulation
 //A specie is a unique genotype in the cell population
+//Under infinite alleles a specie only stores the mutations it gained on top of its parent specie, so deep
+//lineages share their common prefix. Under a disease model parent is -1 and genotype holds all of the states
+//Code that reads the alleles takes them as a template parameter Species: a vector of species, or anything else
+//that gives a specie& by index (the SpeciesRegistry of the parallel engine), with species[i].count the number of
+//cells of allele i
 struct specie {
     int id;
     int count;
+    int parent;
+    int nmuts;
     std::vector<int> genotype;
     double d,b;
     bool treatment_resistance;
     double red,green,blue; 
 };
 
-//A cell is specified by its coordinates and specie type
+//A cell is specified by its coordinates (relative to the initial cell) and specie type
+//bucket and bpos give its position in the birth sampler (bucket is -1 if it has no free neighbor and so can not divide)
 struct cell {
     short int x,y,z;
+    signed char bucket;
     int id;
+    int bpos;
 };
 
 //For the multi-type branching process
@@ -38,42 +47,103 @@ struct Edge {
     double u, s; 
 };
 
-cell initial_cell(std::vector<specie> &species, double wt_br, double wt_dr);
+//A dose of therapy, given the first time the tumor has size cells or the simulated time reaches time (HUGE_VAL
+//if not used) after the previous dose. A cell of a sensitive allele dies with probability kill, and a cell of a
+//resistant allele with probability kill_resistant
+struct Dose {
+    double size, time;
+    double kill, kill_resistant;
+};
+
+//The tumor right before and right after a dose
+struct DoseRecord {
+    double time;
+    double cells_before, cells_after;
+    int alleles_before, alleles_after;
+    double resistant_before, resistant_after;
+};
+
+//Parameters of a simulation, read from the input list (from R) once so the engine never touches R objects.
+//The mutation parameters are only used under infinite alleles
+struct SimParams {
+    int tumor_size;
+    double wt_br, wt_dr;
+    double u, du, s;
+    bool verbose;
+    //size the tumor grows to after the last dose of therapy (0 for tumor_size)
+    int recurrent_size;
+    double tr;
+    //doses of therapy, in the order they are given (see therapy.h). Without them, a positive recurrent_size
+    //treats the tumor once it has tumor_size cells
+    std::vector<Dose> therapy;
+    //under a disease model, the alleles that carry any of these states (sorted) are resistant
+    std::vector<int> resistant_states;
+    //write genotypes in the compact (CSR) format
+    bool csr;
+    //threads used to grow a single tumor
+    int nthreads;
+    //snapshots are written to this file (if it is not empty), see checkpoint.h
+    std::string checkpoint;
+    std::vector<double> checkpoint_sizes;
+    double checkpoint_every;
+    //cells are written to this file instead of being returned (if it is not empty), see cellfile.h
+    std::string cell_file;
+    //return the counters of the run, see stats.h
+    bool stats;
+    //wall clock budget of the run in seconds (0 for none), see progress.h
+    double max_wall_seconds;
+    //seconds between two progress reports (0 for none), and the R function they are passed to (or R_NilValue)
+    double progress_every;
+    SEXP progress_callback;
+    //whether the run may call into R to look for interrupts (not on worker threads)
+    bool interruptible;
+};
+
+struct SimContext;
 
-bool*** init_lattice(void); 
+void init_lattice(Lattice &lattice); 
 
-void gv_init(const int N, const double wt_br, const double wt_dr, const double u, const double du, const double s);
+void gv_init(SimContext &ctx, const int N, const double wt_br, const double wt_dr, const double u, const double du, const double s);
 std::vector<std::vector<int> > get_perms(std::vector<int> v);
 std::vector<std::vector<Edge > > processG(Rcpp::NumericMatrix G);
 
 namespace SimUtils {
-    void initIA(Rcpp::List input);
-    void initUDT(Rcpp::List input);
+    SimParams initIA(SimContext &ctx, Rcpp::List input);
+    SimParams initUDT(SimContext &ctx, Rcpp::List input);
+    //continue a simulation from a snapshot (see checkpoint.h)
+    SimParams initResume(SimContext &ctx, Rcpp::List input);
+    Rcpp::NumericVector params_vector(const SimParams &p, const bool udt);
+    //the doses of therapy of a run (a single dose at tumor_size if only recurrent_size was given)
+    std::vector<Dose> schedule(const SimParams &p);
+    //rebuild the free neighbors, birth sampler and death rate once the lattice holds exactly the cells (at any index),
+    //and draw from the channels from now on
+    void rebuild_channels(SimContext &ctx, const int nthreads);
 
     cell initial_cell(std::vector<specie> &species, double wt_br, double wt_dr);    
 
-    void trashcan(bool*** lattice); 
+    void trashcan(Lattice &lattice); 
 }
 
 inline int max_mut(std::vector<specie> &species) {
     int max = 0;
     for(int i = 0; i < species.size(); ++i) {
-        if(species[i].genotype.size() > max) {
-            max = species[i].genotype.size(); 
+        if(species[i].nmuts > max) {
+            max = species[i].nmuts; 
         }
     }
     return max;
 }
 
-inline std::vector<int> bubblesort(std::vector<int> a) {
-    for(int i = 0; i < a.size(); ++i) {
-        for(int j = i+1; j < a.size(); ++j) {
-            if(a[j] < a[i]) {
-                std::swap(a[i],a[j]);
-            }
-        }
+//All of the mutations of a specie, oldest first
+inline std::vector<int> full_genotype(const std::vector<specie> &species, int id) {
+    std::vector<int> gtype(species[id].nmuts);
+    int end = gtype.size();
+    while(id != -1) {
+        end -= species[id].genotype.size();
+        std::copy(species[id].genotype.begin(), species[id].genotype.end(), gtype.begin() + end);
+        id = species[id].parent;
     }
-    return a;
+    return gtype;
 }
 
 #endif 
\ No newline at end of file
@@ -0,0 +1,301 @@
+#include"spatial.h"
+#include"sampling.h"
+#include<cmath>
+#include<algorithm>
+
+SharedMutations::SharedMutations(const Rcpp::IntegerVector &offsets, const Rcpp::IntegerVector &mutations,
+                                 const Rcpp::IntegerVector &parent, const Rcpp::IntegerVector &child) :
+    offsets(offsets.begin()), mutations(mutations.begin()), paths(true) {
+    const int nalleles = offsets.size() - 1, nentries = mutations.size(), nedges = child.size();
+    int nmutations = 1;
+    for(int j = 0; j < nentries; ++j) {nmutations = std::max(nmutations, mutations[j] + 1);}
+    for(int i = 0; i < nedges; ++i) {nmutations = std::max(nmutations, child[i] + 1);}
+
+    //A mutation is numbered after its parent, so the depths are found in one pass. Under a disease
+    //model the tree is a single (0,0) placeholder row
+    std::vector<int> mparent(nmutations, -1), mdepth(nmutations, 0), owner(nmutations, -1);
+    for(int i = 0; i < nedges && paths; ++i) {
+        if(parent[i] < 0 || child[i] <= parent[i]) {paths = false;}
+        else {mparent[child[i]] = parent[i];}
+    }
+    mdepth[0] = 1;
+    for(int m = 1; m < nmutations; ++m) {
+        if(mparent[m] != -1 && mdepth[mparent[m]] > 0) {mdepth[m] = mdepth[mparent[m]] + 1;}
+    }
+
+    //the genotype of every allele must be the path to its last mutation, which ends no other allele
+    for(int a = 0; a < nalleles && paths; ++a) {
+        const int n = length(a);
+        const int last = n > 0 ? mutations[offsets[a+1] - 1] : 0;
+        if(n == 0 || mdepth[last] != n || owner[last] != -1) {paths = false;}
+        else {owner[last] = a;}
+    }
+    if(!paths || nalleles == 0) {return;}
+
+    //The parent of an allele is the allele of the nearest mutation above its own. Only the mutations
+    //gained with the allele are walked through, so this is linear in the number of mutations
+    std::vector<int> aparent(nalleles, -1), start(nalleles + 1, 0);
+    int root = -1;
+    for(int a = 0; a < nalleles; ++a) {
+        int m = mparent[mutations[offsets[a+1] - 1]];
+        while(m != -1 && owner[m] == -1) {m = mparent[m];}
+        if(m != -1) {aparent[a] = owner[m]; ++start[owner[m] + 1];}
+        else if(root == -1) {root = a;}
+        else {paths = false; return;}
+    }
+    for(int a = 0; a < nalleles; ++a) {start[a+1] += start[a];}
+    std::vector<int> children(nalleles), next(start.begin(), start.end() - 1);
+    for(int a = 0; a < nalleles; ++a) {
+        if(aparent[a] != -1) {children[next[aparent[a]]++] = a;}
+    }
+
+    //Euler tour: an allele is written when it is entered and after each of its children
+    tour.reserve(2*nalleles);
+    first.assign(nalleles, -1);
+    std::vector<int> stack(1, root);
+    next.assign(start.begin(), start.end() - 1);
+    while(!stack.empty()) {
+        const int a = stack.back();
+        if(first[a] == -1) {first[a] = tour.size();}
+        tour.push_back(a);
+        if(next[a] < start[a+1]) {stack.push_back(children[next[a]++]);}
+        else {stack.pop_back();}
+    }
+
+    const int len = tour.size(), nblocks = (len + LCA_BLOCK - 1)/LCA_BLOCK;
+    tour_depth.resize(len);
+    for(int i = 0; i < len; ++i) {tour_depth[i] = length(tour[i]);}
+    level.assign(nblocks + 1, 0);
+    for(int i = 2; i <= nblocks; ++i) {level[i] = level[i/2] + 1;}
+    std::vector<int> row(nblocks);
+    for(int i = 0; i < len; ++i) {
+        if(i % LCA_BLOCK == 0 || tour_depth[i] < tour_depth[row[i/LCA_BLOCK]]) {row[i/LCA_BLOCK] = i;}
+    }
+    table.push_back(row);
+    for(int k = 1; (1 << k) <= nblocks; ++k) {
+        const std::vector<int> &prev = table[k-1];
+        row.resize(nblocks - (1 << k) + 1);
+        for(size_t i = 0; i < row.size(); ++i) {
+            const int u = prev[i], v = prev[i + (1 << (k-1))];
+            row[i] = tour_depth[u] <= tour_depth[v] ? u : v;
+        }
+        table.push_back(row);
+    }
+}
+
+//Sums of the Jaccard index by distance (rounded to the nearest integer)
+struct DistanceBins {
+    std::vector<double> n, sum, sumsq;
+
+    inline void add(const double distance, const double j) {
+        const size_t b = (size_t)(distance + 0.5);
+        if(b >= n.size()) {
+            n.resize(b + 1, 0); sum.resize(b + 1, 0); sumsq.resize(b + 1, 0);
+        }
+        n[b] += 1; sum[b] += j; sumsq[b] += j*j;
+    }
+
+    void merge(const DistanceBins &other) {
+        if(other.n.size() > n.size()) {
+            n.resize(other.n.size(), 0); sum.resize(other.n.size(), 0); sumsq.resize(other.n.size(), 0);
+        }
+        for(size_t b = 0; b < other.n.size(); ++b) {
+            n[b] += other.n[b]; sum[b] += other.sum[b]; sumsq[b] += other.sumsq[b];
+        }
+    }
+};
+
+static inline double jaccard_index(const SharedMutations &shared, const int a, const int b) {
+    const double common = shared.shared(a, b);
+    const double all = shared.length(a) + shared.length(b) - common;
+    return all > 0 ? common/all : 1;
+}
+
+Rcpp::List Spatial::jaccard(Rcpp::List input) {
+    Rcpp::IntegerVector x = input["x"], y = input["y"], z = input["z"], genotype = input["genotype"];
+    Rcpp::IntegerVector offsets = input["offsets"], mutations = input["mutations"];
+    Rcpp::IntegerVector parent = input["parent"], child = input["child"];
+    const int nthreads = input["nthreads"];
+    const int ncells = x.size();
+    SharedMutations shared(offsets, mutations, parent, child);
+
+    //Each block of cells or pairs is added up in its own bins, merged at the end. There are more
+    //blocks than threads so that uneven blocks are balanced
+    std::vector<DistanceBins> bins;
+    const int *px = x.begin(), *py = y.begin(), *pz = z.begin(), *pg = genotype.begin();
+
+    if(input.containsElementNamed("radius")) {
+        //every pair within the radius is found once, from the cell that comes first in (z,y,x) order
+        const double radius = input["radius"];
+        const int r = (int)radius;
+        std::vector<int> dx, dy, dz;
+        std::vector<double> dist;
+        for(int k = 0; k <= r; ++k) {
+            for(int j = -r; j <= r; ++j) {
+                for(int i = -r; i <= r; ++i) {
+                    const double d = sqrt((double)(i*i + j*j + k*k));
+                    if(d > radius || (k == 0 && (j < 0 || (j == 0 && i <= 0)))) {continue;}
+                    dx.push_back(i); dy.push_back(j); dz.push_back(k); dist.push_back(d);
+                }
+            }
+        }
+        TumorIndex index(x, y, z, genotype);
+        const int nblocks = std::max(1, std::min(ncells, 16*nthreads));
+        bins.resize(nblocks);
+        #pragma omp parallel for schedule(dynamic) num_threads(nthreads)
+        for(int t = 0; t < nblocks; ++t) {
+            const int from = (int)((double)ncells*t/nblocks), to = (int)((double)ncells*(t+1)/nblocks);
+            for(int c = from; c < to; ++c) {
+                for(size_t k = 0; k < dist.size(); ++k) {
+                    const int g = index.at(px[c] + dx[k], py[c] + dy[k], pz[c] + dz[k]);
+                    if(g >= 0) {bins[t].add(dist[k], jaccard_index(shared, pg[c], g));}
+                }
+            }
+        }
+    } else {
+        //the pairs are drawn from R's generator beforehand, so they do not depend on the threads
+        const int npairs = input["N"];
+        std::vector<int> first(npairs), second(npairs);
+        for(int k = 0; k < npairs; ++k) {
+            first[k] = std::min(ncells - 1, (int)(unif_rand()*ncells));
+            second[k] = std::min(ncells - 2, (int)(unif_rand()*(ncells - 1)));
+            if(second[k] >= first[k]) {++second[k];}
+        }
+        const int nblocks = std::max(1, std::min(npairs, 16*nthreads));
+        bins.resize(nblocks);
+        #pragma omp parallel for schedule(dynamic) num_threads(nthreads)
+        for(int t = 0; t < nblocks; ++t) {
+            const int from = (int)((double)npairs*t/nblocks), to = (int)((double)npairs*(t+1)/nblocks);
+            for(int k = from; k < to; ++k) {
+                const int a = first[k], b = second[k];
+                const double d = sqrt((double)(px[a]-px[b])*(px[a]-px[b]) + (double)(py[a]-py[b])*(py[a]-py[b]) +
+                                      (double)(pz[a]-pz[b])*(pz[a]-pz[b]));
+                bins[t].add(d, jaccard_index(shared, pg[a], pg[b]));
+            }
+        }
+    }
+
+    for(size_t t = 1; t < bins.size(); ++t) {bins[0].merge(bins[t]);}
+
+    //only the distances with at least one pair are returned
+    std::vector<int> distance;
+    std::vector<double> mean, variance, pairs;
+    const DistanceBins &all = bins[0];
+    for(size_t b = 0; b < all.n.size(); ++b) {
+        if(all.n[b] == 0) {continue;}
+        distance.push_back(b);
+        mean.push_back(all.sum[b]/all.n[b]);
+        variance.push_back(all.n[b] > 1 ? std::max(0.0, (all.sumsq[b] - all.sum[b]*all.sum[b]/all.n[b])/(all.n[b] - 1)) : NA_REAL);
+        pairs.push_back(all.n[b]);
+    }
+
+    Rcpp::List out = Rcpp::List::create();
+    out.push_back(Rcpp::wrap(distance), "distance");
+    out.push_back(Rcpp::wrap(mean), "mean");
+    out.push_back(Rcpp::wrap(variance), "variance");
+    out.push_back(Rcpp::wrap(pairs), "pairs");
+    out.push_back(shared.tree(), "tree");
+    return out;
+}
+
+//Sums over the cells by distance from the center
+struct RadialBins {
+    std::vector<double> n, sum, sumsq, drivers, resistant;
+
+    inline void add(const int b, const double nmuts, const bool driver, const bool res) {
+        if(b >= (int)n.size()) {resize(b + 1);}
+        n[b] += 1; sum[b] += nmuts; sumsq[b] += nmuts*nmuts;
+        drivers[b] += driver; resistant[b] += res;
+    }
+
+    void resize(const size_t size) {
+        n.resize(size, 0); sum.resize(size, 0); sumsq.resize(size, 0);
+        drivers.resize(size, 0); resistant.resize(size, 0);
+    }
+
+    void merge(const RadialBins &other) {
+        if(other.n.size() > n.size()) {resize(other.n.size());}
+        for(size_t b = 0; b < other.n.size(); ++b) {
+            n[b] += other.n[b]; sum[b] += other.sum[b]; sumsq[b] += other.sumsq[b];
+            drivers[b] += other.drivers[b]; resistant[b] += other.resistant[b];
+        }
+    }
+};
+
+Rcpp::List Spatial::radial(Rcpp::List input) {
+    Rcpp::IntegerVector x = input["x"], y = input["y"], z = input["z"], genotype = input["genotype"];
+    Rcpp::IntegerVector nmuts = input["nmuts"], resistant = input["resistant"];
+    Rcpp::IntegerVector offsets = input["offsets"], mutations = input["mutations"], drivers = input["drivers"];
+    Rcpp::NumericVector center = input["center"];
+    const int nthreads = input["nthreads"];
+    const int ncells = x.size(), nalleles = offsets.size() - 1;
+    const int nentries = mutations.size(), ndrivers = drivers.size();
+
+    //whether each allele carries a driver mutation
+    int nmutations = 1;
+    for(int j = 0; j < nentries; ++j) {nmutations = std::max(nmutations, mutations[j] + 1);}
+    std::vector<char> is_driver(nmutations, 0), has_driver(nalleles, 0);
+    for(int j = 0; j < ndrivers; ++j) {
+        if(drivers[j] >= 0 && drivers[j] < nmutations) {is_driver[drivers[j]] = 1;}
+    }
+    for(int a = 0; a < nalleles; ++a) {
+        for(int j = offsets[a]; j < offsets[a+1] && !has_driver[a]; ++j) {has_driver[a] = is_driver[mutations[j]];}
+    }
+
+    const int *px = x.begin(), *py = y.begin(), *pz = z.begin(), *pg = genotype.begin();
+    const int *pm = nmuts.begin(), *pr = resistant.begin();
+    const double cx = center[0], cy = center[1], cz = center[2];
+    std::vector<int> bin(ncells);
+    const int nblocks = std::max(1, std::min(ncells, 16*nthreads));
+    std::vector<RadialBins> bins(nblocks);
+    #pragma omp parallel for schedule(dynamic) num_threads(nthreads)
+    for(int t = 0; t < nblocks; ++t) {
+        const int from = (int)((double)ncells*t/nblocks), to = (int)((double)ncells*(t+1)/nblocks);
+        for(int c = from; c < to; ++c) {
+            const double d = sqrt((px[c] - cx)*(px[c] - cx) + (py[c] - cy)*(py[c] - cy) + (pz[c] - cz)*(pz[c] - cz));
+            bin[c] = (int)(d + 0.5);
+            bins[t].add(bin[c], pm[c], has_driver[pg[c]], pr[c] != 0);
+        }
+    }
+    for(int t = 1; t < nblocks; ++t) {bins[0].merge(bins[t]);}
+    const RadialBins &all = bins[0];
+    const int nbins = all.n.size();
+
+    //The alleles of each bin are counted by grouping the cells by bin, and marking each allele
+    //with the last bin it was seen in
+    std::vector<int> start(nbins + 1, 0);
+    for(int c = 0; c < ncells; ++c) {++start[bin[c] + 1];}
+    for(int b = 0; b < nbins; ++b) {start[b+1] += start[b];}
+    std::vector<int> grouped(ncells), next(start.begin(), start.end() - 1);
+    for(int c = 0; c < ncells; ++c) {grouped[next[bin[c]]++] = pg[c];}
+    std::vector<int> seen(nalleles, -1), alleles(nbins, 0);
+    for(int b = 0; b < nbins; ++b) {
+        for(int k = start[b]; k < start[b+1]; ++k) {
+            if(seen[grouped[k]] != b) {seen[grouped[k]] = b; ++alleles[b];}
+        }
+    }
+
+    //only the distances with at least one cell are returned
+    std::vector<int> distance, cells, nalive;
+    std::vector<double> mean, variance, driver_fraction, resistant_fraction;
+    for(int b = 0; b < nbins; ++b) {
+        if(all.n[b] == 0) {continue;}
+        distance.push_back(b);
+        cells.push_back(all.n[b]);
+        mean.push_back(all.sum[b]/all.n[b]);
+        variance.push_back(all.n[b] > 1 ? std::max(0.0, (all.sumsq[b] - all.sum[b]*all.sum[b]/all.n[b])/(all.n[b] - 1)) : NA_REAL);
+        driver_fraction.push_back(all.drivers[b]/all.n[b]);
+        resistant_fraction.push_back(all.resistant[b]/all.n[b]);
+        nalive.push_back(alleles[b]);
+    }
+
+    Rcpp::List out = Rcpp::List::create();
+    out.push_back(Rcpp::wrap(distance), "distance");
+    out.push_back(Rcpp::wrap(cells), "cells");
+    out.push_back(Rcpp::wrap(mean), "mean");
+    out.push_back(Rcpp::wrap(variance), "variance");
+    out.push_back(Rcpp::wrap(driver_fraction), "driver_fraction");
+    out.push_back(Rcpp::wrap(resistant_fraction), "resistant_fraction");
+    out.push_back(Rcpp::wrap(nalive), "alleles");
+    return out;
+}
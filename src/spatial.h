@@ -0,0 +1,93 @@
+/*
+SITH: An R package for visualizing and analyzing a spatial model of intra-tumor heterogeneity
+Author: Phillip Nicol
+License: GPL-2
+*/
+
+/***********************************************************
+Jaccard index between pairs of cells. Under infinite alleles the genotype of an allele is the path
+from the root of the phylogenetic tree to its last mutation (the mutations gained in one division are
+chained one after the other in the tree), so two alleles share exactly the
+mutations of their lowest common ancestor. The alleles are put in a tree (an allele is the child of
+the allele of the nearest mutation above its own), and the ancestor is found with a range minimum over
+an Euler tour of that tree. The tour is cut in blocks of LCA_BLOCK positions: the minima of runs of whole
+blocks are kept in a sparse table, and the ends of a range are scanned, so the table is small enough
+for millions of alleles. A pair then costs a few lookups instead of a merge of two genotypes. Under a
+disease model the genotypes are sets of states rather than paths, and they are intersected directly.
+The radial profile of a tumor is built in one pass over the cells, which are added to the bins of their
+distance from a center. Each block of cells has its own bins, merged at the end.
+*******************************************************/
+
+#ifndef SPATIAL_H_INCLUDED
+#define SPATIAL_H_INCLUDED
+
+#include<Rcpp.h>
+#include<vector>
+
+#define LCA_BLOCK 16
+
+//Number of mutations shared by two alleles, from genotypes given as offsets into a vector of mutations
+class SharedMutations {
+public:
+    SharedMutations(const Rcpp::IntegerVector &offsets, const Rcpp::IntegerVector &mutations,
+                    const Rcpp::IntegerVector &parent, const Rcpp::IntegerVector &child);
+
+    inline int length(const int a) const {return offsets[a+1] - offsets[a];}
+    //whether shared mutations are found from the allele tree (rather than by merging genotypes)
+    bool tree() const {return paths;}
+
+    inline int shared(const int a, const int b) const {
+        if(a == b) {return length(a);}
+        if(paths) {return length(lca(a, b));}
+        //sorted sets of states
+        int n = 0;
+        for(int i = offsets[a], j = offsets[b]; i < offsets[a+1] && j < offsets[b+1];) {
+            if(mutations[i] < mutations[j]) {++i;}
+            else if(mutations[i] > mutations[j]) {++j;}
+            else {++n; ++i; ++j;}
+        }
+        return n;
+    }
+
+private:
+    //lowest common ancestor of two alleles
+    inline int lca(const int a, const int b) const {
+        int l = first[a], r = first[b];
+        if(l > r) {std::swap(l, r);}
+        const int bl = l/LCA_BLOCK, br = r/LCA_BLOCK;
+        int best = l;
+        if(br - bl < 2) {
+            for(int i = l + 1; i <= r; ++i) {if(tour_depth[i] < tour_depth[best]) {best = i;}}
+        } else {
+            for(int i = l + 1; i < (bl + 1)*LCA_BLOCK; ++i) {if(tour_depth[i] < tour_depth[best]) {best = i;}}
+            for(int i = br*LCA_BLOCK; i <= r; ++i) {if(tour_depth[i] < tour_depth[best]) {best = i;}}
+            const int k = level[br - bl - 1];
+            const int u = table[k][bl + 1], v = table[k][br - (1 << k)];
+            if(tour_depth[u] < tour_depth[best]) {best = u;}
+            if(tour_depth[v] < tour_depth[best]) {best = v;}
+        }
+        return tour[best];
+    }
+
+    const int *offsets, *mutations;
+    //whether the genotypes are the paths of the phylogenetic tree
+    bool paths;
+    //Euler tour, with the number of mutations of the allele at each position
+    std::vector<int> tour, tour_depth;
+    //first position of each allele in the tour, and floor(log2) of the numbers of blocks
+    std::vector<int> first, level;
+    //table[k][i] is the position of the shallowest allele in blocks [i, i + 2^k) of the tour
+    std::vector<std::vector<int> > table;
+};
+
+namespace Spatial {
+    //Mean and variance of the Jaccard index of pairs of cells by their distance (rounded), for random pairs
+    //or for all the pairs within a radius
+    Rcpp::List jaccard(Rcpp::List input);
+
+    //Number of cells, mean and variance of the number of mutations, fraction of cells carrying a driver,
+    //fraction of resistant cells and number of alleles by distance from a center (rounded)
+    Rcpp::List radial(Rcpp::List input);
+}
+
+#endif
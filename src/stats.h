@@ -0,0 +1,86 @@
+/*
+SITH: An R package for visualizing and analyzing a spatial model of intra-tumor heterogeneity
+Author: Phillip Nicol
+License: GPL-2
+*/
+
+/***********************************************************
+Counters of a run, to see where the time of a simulation goes. The counters are increments on the
+paths the engine takes anyway, so they are always kept and only written out when they are asked for.
+The birth sampler and the disease model keep their own counts of draws and lookups, which are added
+in at the end (and before a sampler is cleared by the parallel engine). Memory only grows while the
+tumor grows, so it is measured at the end of each phase of growth and whenever the parallel engine
+puts the tumor back together, and the largest value is kept.
+Everything counts this call only: a simulation resumed from a snapshot starts again from zero.
+*******************************************************/
+
+#ifndef STATS_H_INCLUDED
+#define STATS_H_INCLUDED
+
+#include<chrono>
+#include<vector>
+#include"simutils.h"
+#include"sampler.h"
+
+//wall clock time in seconds, from an arbitrary origin
+inline double wall_seconds() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct RunStats {
+    RunStats() {clear();}
+
+    void clear() {
+        events = 0; births = 0; deaths = 0; skipped_deaths = 0;
+        birth_draws = 0; birth_rejections = 0; death_draws = 0;
+        dropped_daughters = 0; new_species = 0; max_rate_raises = 0;
+        genotype_lookups = 0; genotype_cache_hits = 0;
+        init_seconds = 0; growth_seconds = 0; treatment_seconds = 0; output_seconds = 0;
+        lattice_bytes = 0; cell_bytes = 0; species_bytes = 0;
+    }
+
+    //the draws of a birth sampler (sign -1 takes out the draws it already had, e.g. from a snapshot)
+    void add_sampler(const RateSampler &sampler, const double sign = 1) {
+        birth_draws += sign*sampler.draws();
+        birth_rejections += sign*(sampler.draws() - sampler.hits());
+        max_rate_raises += sign*sampler.raises();
+    }
+
+    //the counts of a part of the tumor grown on its own (a domain of the parallel engine)
+    void add_counts(const RunStats &other) {
+        events += other.events; births += other.births; deaths += other.deaths;
+        skipped_deaths += other.skipped_deaths; death_draws += other.death_draws;
+        dropped_daughters += other.dropped_daughters;
+    }
+
+    //memory held by the tumor at some point of the run (bytes)
+    void note_memory(const double lattice, const double cells, const double species) {
+        lattice_bytes = std::max(lattice_bytes, lattice);
+        cell_bytes = std::max(cell_bytes, cells);
+        species_bytes = std::max(species_bytes, species);
+    }
+
+    void note_memory(const Lattice &lattice, const std::vector<cell> &cells, const std::vector<specie> &species) {
+        double bytes = species.capacity()*sizeof(specie);
+        for(size_t i = 0; i < species.size(); ++i) {bytes += species[i].genotype.capacity()*sizeof(int);}
+        note_memory(lattice.bytes(), cells.capacity()*sizeof(cell), bytes);
+    }
+
+    //events carried out, and deaths drawn while a single cell was left (the engine keeps that cell)
+    double events, births, deaths, skipped_deaths;
+    //draws of the two event channels (a death draw is rejected unless it is a death or a skipped death)
+    double birth_draws, birth_rejections, death_draws;
+    //daughters placed across the border of two domains whose site had been filled in the meantime
+    double dropped_daughters;
+    double new_species;
+    //times the largest birth rate in the sampler went up
+    double max_rate_raises;
+    //genotypes looked up under a disease model, and those found in the cache of transitions
+    double genotype_lookups, genotype_cache_hits;
+    //wall clock time of each step
+    double init_seconds, growth_seconds, treatment_seconds, output_seconds;
+    //largest memory held by the lattice, the cells and the species
+    double lattice_bytes, cell_bytes, species_bytes;
+};
+
+#endif
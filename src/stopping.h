@@ -0,0 +1,127 @@
+/*
+SITH: An R package for visualizing and analyzing a spatial model of intra-tumor heterogeneity
+Author: Phillip Nicol
+License: GPL-2
+*/
+
+/***********************************************************
+Conditions that end a simulation before the tumor reaches its size: a simulated time, an allele other
+than the wild type carrying a fraction of the cells, a number of driver mutations, a fraction of
+resistant cells, and extinction. The run stops as soon as any of the conditions holds, or as soon as
+all of them hold at the same time.
+The engine checks the rule after every event, so nothing is recomputed there. The time and the
+drivers are read as they are. The resistant cells are counted up and down by the births and deaths,
+and the largest allele is followed as the alleles gain cells: an allele only takes the lead when it
+gains a cell, so once the leader has lost cells another allele is noticed at its next birth. These
+counts are only kept if a condition needs them, and they are rebuilt from the alleles whenever the
+engine recounts them (at the start of a run, after treatment and after a parallel phase).
+The parallel engine does not keep allele counts, so it checks the rule at the end of each window.
+The engine keeps the last cell of a tumor alive, so a tumor can only die out when it is treated.
+With the extinction condition the last cell may die too. A tumor that has died out always stops.
+*******************************************************/
+
+#ifndef STOPPING_H_INCLUDED
+#define STOPPING_H_INCLUDED
+
+#include<climits>
+#include"simutils.h"
+
+class StopRule {
+public:
+    StopRule() {init(HUGE_VAL, HUGE_VAL, INT_MAX, HUGE_VAL, false, false);}
+
+    //a condition that is not asked for is HUGE_VAL (or INT_MAX drivers). all combines them with AND
+    void init(const double time, const double clone_freq, const int drivers, const double resistant_fraction,
+              const bool extinction, const bool all) {
+        max_time = time;
+        max_clone_freq = clone_freq;
+        max_drivers = drivers;
+        max_resistant = resistant_fraction;
+        extinct = extinction;
+        require_all = all;
+        nconditions = (time < HUGE_VAL) + (clone_freq < HUGE_VAL) + (drivers < INT_MAX) + (resistant_fraction < HUGE_VAL);
+        leader = -1;
+        resistant = 0;
+    }
+
+    bool active() const {return nconditions > 0 || extinct;}
+    //whether the last cell of the tumor may die
+    bool extinction() const {return extinct;}
+    //whether the rule needs the counts of the alleles
+    bool counts() const {return max_clone_freq < HUGE_VAL || max_resistant < HUGE_VAL;}
+    //whether the rule needs driver mutations (which a disease model does not have)
+    bool drivers() const {return max_drivers < INT_MAX;}
+
+    //rebuild the counts (Species as described at specie in simutils.h)
+    template<class Species>
+    void reset(Species &species, const int nspecies) {
+        leader = -1;
+        resistant = 0;
+        if(!counts()) {return;}
+        for(int i = 0; i < nspecies; ++i) {
+            const specie &sp = species[i];
+            if(i > 0 && sp.count > 0 && (leader == -1 || sp.count > species[leader].count)) {leader = i;}
+            if(sp.treatment_resistance) {resistant += sp.count;}
+        }
+    }
+
+    //a daughter of allele daughter was born, and its mother changed from allele parent to allele mother
+    inline void birth(const std::vector<specie> &species, const int daughter, const int mother, const int parent) {
+        if(!counts()) {return;}
+        resistant += species[daughter].treatment_resistance;
+        follow(species, daughter);
+        if(mother != parent) {
+            resistant += species[mother].treatment_resistance - species[parent].treatment_resistance;
+            follow(species, mother);
+        }
+    }
+
+    //a cell of allele id died
+    inline void death(const std::vector<specie> &species, const int id) {
+        resistant -= species[id].treatment_resistance;
+    }
+
+    //Whether the run has to stop, with the conditions that hold in reason. Must be called with the counts
+    //up to date (after reset or the births and deaths since)
+    template<class Species>
+    bool check(const double t, const double population, const int ndrivers, Species &species,
+               std::string &reason) const {
+        if(population == 0) {
+            if(!extinct) {return false;}
+            reason = "extinction";
+            return true;
+        }
+        if(nconditions == 0) {return false;}
+        const bool held[4] = {t >= max_time,
+                              leader != -1 && species[leader].count >= max_clone_freq*population,
+                              ndrivers >= max_drivers,
+                              resistant > 0 && resistant >= max_resistant*population};
+        const int nheld = held[0] + held[1] + held[2] + held[3];
+        if(nheld == 0 || (require_all && nheld < nconditions)) {return false;}
+
+        static const char* names[4] = {"time", "clone_freq", "drivers", "resistant_fraction"};
+        reason = "";
+        for(int k = 0; k < 4; ++k) {
+            if(!held[k]) {continue;}
+            if(!reason.empty()) {reason += ", ";}
+            reason += names[k];
+        }
+        return true;
+    }
+
+private:
+    double max_time, max_clone_freq, max_resistant;
+    int max_drivers;
+    bool extinct, require_all;
+    int nconditions;
+
+    //the allele other than the wild type with the most cells (-1 if there is none), and the resistant cells
+    int leader;
+    double resistant;
+
+    inline void follow(const std::vector<specie> &species, const int id) {
+        if(id > 0 && (leader == -1 || species[id].count > species[leader].count)) {leader = id;}
+    }
+};
+
+#endif
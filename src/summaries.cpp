@@ -0,0 +1,93 @@
+#include"summaries.h"
+#include"postproc.h"
+
+SummarySpec Summaries::read(Rcpp::List input) {
+    std::vector<std::string> which = Rcpp::as<std::vector<std::string> >(input["summaries"]);
+    SummarySpec spec;
+    spec.sfs = std::find(which.begin(), which.end(), "sfs") != which.end();
+    spec.clones = std::find(which.begin(), which.end(), "clones") != which.end();
+    spec.mean_nmuts = std::find(which.begin(), which.end(), "mean_nmuts") != which.end();
+    spec.drivers = std::find(which.begin(), which.end(), "drivers") != which.end();
+    spec.radial = std::find(which.begin(), which.end(), "radial") != which.end();
+    spec.sfs_bins = input["sfs_bins"];
+    spec.radial_bins = input["radial_bins"];
+    spec.clone_freq = input["clone_freq"];
+    return spec;
+}
+
+Rcpp::CharacterVector Summaries::names(const SummarySpec &spec) {
+    std::vector<std::string> out;
+    if(spec.sfs) {
+        for(int k = 1; k <= spec.sfs_bins; ++k) {out.push_back("sfs_" + std::to_string(k));}
+    }
+    if(spec.clones) {out.push_back("clones");}
+    if(spec.mean_nmuts) {out.push_back("mean_nmuts");}
+    if(spec.drivers) {out.push_back("drivers");}
+    if(spec.radial) {
+        for(int k = 1; k <= spec.radial_bins; ++k) {out.push_back("radial_" + std::to_string(k));}
+    }
+    return Rcpp::wrap(out);
+}
+
+std::vector<double> Summaries::compute(const SimContext &ctx, const SummarySpec &spec) {
+    const std::vector<cell> &cells = ctx.cells;
+    const std::vector<specie> &species = ctx.species;
+    const double N = cells.size();
+    std::vector<double> out;
+
+    //number of cells carrying each mutation (under a disease model the mutations are the states)
+    std::vector<int> muts;
+    if(spec.sfs || spec.drivers) {
+        muts.assign(ctx.G.empty() ? ctx.total_mutations + 1 : ctx.G.size(), 0);
+        PostProcessing::count_mutations(species, muts.data(), 1);
+    }
+
+    if(spec.sfs) {
+        std::vector<double> sfs(spec.sfs_bins, 0);
+        for(size_t m = 1; m < muts.size(); ++m) {
+            if(muts[m] == 0) {continue;}
+            //bin k holds the frequencies in (k/bins, (k+1)/bins]
+            const int k = (int)ceil(muts[m]*spec.sfs_bins/N) - 1;
+            ++sfs[std::min(std::max(k, 0), spec.sfs_bins - 1)];
+        }
+        out.insert(out.end(), sfs.begin(), sfs.end());
+    }
+    if(spec.clones) {
+        double clones = 0;
+        for(size_t i = 0; i < species.size(); ++i) {
+            if(species[i].count > 0 && species[i].count >= spec.clone_freq*N) {++clones;}
+        }
+        out.push_back(clones);
+    }
+    if(spec.mean_nmuts) {
+        double total = 0;
+        for(size_t i = 0; i < species.size(); ++i) {total += (double)species[i].count*species[i].nmuts;}
+        out.push_back(N > 0 ? total/N : NA_REAL);
+    }
+    if(spec.drivers) {
+        double drivers = 0;
+        for(size_t j = 0; j < ctx.drivers.size(); ++j) {
+            if(muts[ctx.drivers[j]] > 0) {++drivers;}
+        }
+        out.push_back(drivers);
+    }
+    if(spec.radial) {
+        double rmax = 0;
+        for(size_t i = 0; i < cells.size(); ++i) {
+            const cell &c = cells[i];
+            rmax = std::max(rmax, sqrt((double)c.x*c.x + (double)c.y*c.y + (double)c.z*c.z));
+        }
+        std::vector<double> n(spec.radial_bins, 0), sum(spec.radial_bins, 0);
+        for(size_t i = 0; i < cells.size(); ++i) {
+            const cell &c = cells[i];
+            const double r = sqrt((double)c.x*c.x + (double)c.y*c.y + (double)c.z*c.z);
+            const int k = rmax > 0 ? std::min((int)(spec.radial_bins*r/rmax), spec.radial_bins - 1) : 0;
+            ++n[k];
+            sum[k] += species[c.id].nmuts;
+        }
+        for(int k = 0; k < spec.radial_bins; ++k) {
+            out.push_back(n[k] > 0 ? sum[k]/n[k] : NA_REAL);
+        }
+    }
+    return out;
+}
@@ -0,0 +1,44 @@
+/*
+SITH: An R package for visualizing and analyzing a spatial model of intra-tumor heterogeneity
+Author: Phillip Nicol
+License: GPL-2
+*/
+
+/***********************************************************
+Summary statistics of a simulated tumor, for approximate Bayesian computation. They are computed from
+the cells and species held by the engine at the end of the run, so the data frames, genotypes and
+colors of the tumor are never built. Each statistic has a fixed number of values, and the summaries
+of many replicates are the rows of one matrix:
+  sfs        - the site frequency spectrum: numbers of mutations carried by a fraction of the cells in
+               each of sfs_bins bins of equal width over (0,1]. The founding mutation (ID 0) is left out
+  clones     - number of alleles carried by at least clone_freq of the cells
+  mean_nmuts - mean number of mutations of a cell
+  drivers    - number of driver mutations carried by at least one cell
+  radial     - mean number of mutations of the cells in each of radial_bins shells of equal width,
+               from the first cell (at the origin) to the farthest cell. NA for an empty shell
+Nothing here calls into R, so the replicates of a batch are summarized on the worker threads.
+*******************************************************/
+
+#ifndef SUMMARIES_H_INCLUDED
+#define SUMMARIES_H_INCLUDED
+
+#include"context.h"
+
+struct SummarySpec {
+    bool sfs, clones, mean_nmuts, drivers, radial;
+    int sfs_bins, radial_bins;
+    double clone_freq;
+};
+
+namespace Summaries {
+    //the statistics asked for in the input list (from R)
+    SummarySpec read(Rcpp::List input);
+
+    //names of the values, in the order they are computed
+    Rcpp::CharacterVector names(const SummarySpec &spec);
+
+    //the values of the statistics for the tumor in ctx
+    std::vector<double> compute(const SimContext &ctx, const SummarySpec &spec);
+}
+
+#endif
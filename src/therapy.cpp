@@ -0,0 +1,100 @@
+#include"therapy.h"
+#include"simutils.h"
+
+void Therapy::apply(SimContext &ctx, const SimParams &p, const Dose &dose) {
+    std::vector<cell> &cells = ctx.cells;
+    std::vector<specie> &species = ctx.species;
+    const int n = cells.size();
+    const int nspecies = species.size();
+
+    //probability that a cell of each allele dies
+    std::vector<double> kill(nspecies);
+    std::vector<char> is_resistant(nspecies);
+    DoseRecord record;
+    record.time = ctx.time;
+    record.cells_before = n;
+    record.alleles_before = 0;
+    record.resistant_before = 0;
+    bool partial = false;
+    for(int i = 0; i < nspecies; ++i) {
+        is_resistant[i] = species[i].treatment_resistance;
+        kill[i] = is_resistant[i] ? dose.kill_resistant : dose.kill;
+        if(species[i].count > 0) {
+            ++record.alleles_before;
+            if(is_resistant[i]) {record.resistant_before += species[i].count;}
+            if(kill[i] > 0 && kill[i] < 1) {partial = true;}
+        }
+    }
+
+    //one stream per block of cells, split from the stream of the run
+    const int nblocks = (n + THERAPY_BLOCK - 1)/THERAPY_BLOCK;
+    std::vector<Xoshiro256> streams;
+    if(partial) {
+        Xoshiro256 stream;
+        if(ctx.rng.is_native()) {
+            RandomStream child;
+            ctx.rng.split(child);
+            stream = child.generator();
+        } else {
+            //R's generator can only be used on the main thread, so it only seeds the streams
+            stream.seed((uint64_t)ctx.rng.runif(0, 9007199254740992.0));
+        }
+        streams.resize(nblocks);
+        for(int b = 0; b < nblocks; ++b) {
+            streams[b] = stream;
+            stream.jump();
+        }
+    }
+
+    //which cells die, and the number of survivors before each block
+    std::vector<char> dead(n);
+    std::vector<int> offset(nblocks + 1, 0);
+    #pragma omp parallel for schedule(static) num_threads(p.nthreads)
+    for(int b = 0; b < nblocks; ++b) {
+        const int end = std::min(n, (b + 1)*THERAPY_BLOCK);
+        int alive = 0;
+        for(int i = b*THERAPY_BLOCK; i < end; ++i) {
+            const double q = kill[cells[i].id];
+            dead[i] = q >= 1 || (q > 0 && streams[b].uniform() < q);
+            alive += !dead[i];
+        }
+        offset[b + 1] = alive;
+    }
+    for(int b = 0; b < nblocks; ++b) {offset[b + 1] += offset[b];}
+
+    //chunks may be freed, so the lattice is cleared on one thread
+    for(int i = 0; i < n; ++i) {
+        if(dead[i]) {
+            ctx.lattice.clear(cells[i].x, cells[i].y, cells[i].z);
+            --species[cells[i].id].count;
+        }
+    }
+
+    //the survivors keep their order
+    std::vector<cell> survivors(offset[nblocks]);
+    #pragma omp parallel for schedule(static) num_threads(p.nthreads)
+    for(int b = 0; b < nblocks; ++b) {
+        const int end = std::min(n, (b + 1)*THERAPY_BLOCK);
+        int j = offset[b];
+        for(int i = b*THERAPY_BLOCK; i < end; ++i) {
+            if(!dead[i]) {survivors[j++] = cells[i];}
+        }
+    }
+    cells.swap(survivors);
+    std::vector<cell>().swap(survivors);
+
+    //the counters of the birth sampler are lost when it is rebuilt
+    ctx.stats.add_sampler(ctx.birth_sampler);
+    SimUtils::rebuild_channels(ctx, p.nthreads);
+
+    record.cells_after = cells.size();
+    record.alleles_after = 0;
+    record.resistant_after = 0;
+    for(int i = 0; i < nspecies; ++i) {
+        if(species[i].count > 0) {
+            ++record.alleles_after;
+            if(is_resistant[i]) {record.resistant_after += species[i].count;}
+        }
+    }
+    ctx.doses.push_back(record);
+}
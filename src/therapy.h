@@ -0,0 +1,32 @@
+/*
+SITH: An R package for visualizing and analyzing a spatial model of intra-tumor heterogeneity
+Author: Phillip Nicol
+License: GPL-2
+*/
+
+/***********************************************************
+Doses of therapy. A dose kills every cell of an allele with the same probability, which only depends
+on whether the allele is resistant (under infinite alleles, a resistance mutation; under a disease model,
+one of the resistant states). So the decision is made once per allele: alleles that all die or all
+survive cost nothing more, and the other cells each draw a uniform. The cells are cut into blocks with a
+stream of random numbers each, so the cells that die do not depend on the number of threads.
+The survivors are then packed, in order, into a new vector of cells, with the offset of each block found
+from the number of survivors of the blocks before it. The sites of the dead cells are cleared from the
+lattice in one pass, and the lattice indices, free neighbors and event channels of the survivors are
+rebuilt, instead of removing the dead cells one by one from the event channels.
+*******************************************************/
+
+#ifndef THERAPY_H_INCLUDED
+#define THERAPY_H_INCLUDED
+
+#include"context.h"
+
+//cells in a block of random numbers
+#define THERAPY_BLOCK 65536
+
+namespace Therapy {
+    //give the dose to the tumor in ctx on p.nthreads threads, and append its record to ctx.doses
+    void apply(SimContext &ctx, const SimParams &p, const Dose &dose);
+}
+
+#endif